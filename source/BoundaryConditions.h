@@ -22,6 +22,7 @@ class BoundaryConditions
 protected:
 
     int s[3], e[3];
+    int oz; // z offset of the halo (chunk start, z halos are chunk independent)
 
     const RealPtrVec_t& pdata;
     const uint_t startZ, deltaZ;
@@ -37,6 +38,16 @@ protected:
         e[0] =  dir==0? 3 : TGrid::sizeX;
         e[1] =  dir==1? 3 : TGrid::sizeY;
         e[2] =  dir==2? 3 : startZ + deltaZ;
+
+        oz = s[2];
+    }
+
+    // z halos only depend on the first/last 3 slices, they are set if these
+    // are within the slices of the chunk
+    template<int dir, int side>
+    inline bool _in_chunk() const
+    {
+        return dir != 2 || (side == 0 ? 0 == startZ : TGrid::sizeZ == startZ + deltaZ);
     }
 
 
@@ -49,63 +60,66 @@ public:
     {
         s[0]=s[1]=s[2]=0;
         e[0]=e[1]=e[2]=0;
+        oz = 0;
     }
 
     inline Real operator()(const Real * const psrc, int ix, int iy, int iz) const
     {
-        assert(!isnan(psrc[ix + TGrid::sizeX * (iy + TGrid::sizeY * iz)]));
-        return psrc[ix + TGrid::sizeX * (iy + TGrid::sizeY * iz)];
+        assert(!isnan(psrc[TGrid::linaccess(ix, iy, iz)]));
+        return psrc[TGrid::linaccess(ix, iy, iz)];
     }
 
     template<int dir, int side, index_map map>
     void applyBC_absorbing(RealPtrVec_t& halo)
     {
+        if (!_in_chunk<dir,side>()) return;
         _setup<dir>();
 
-#pragma omp parallel for
-        for (int p = 0; p < TGrid::NVAR; ++p)
-        {
-            Real * const phalo = halo[p];
-            const Real * const psrc = pdata[p];
+#pragma omp parallel for collapse(2) schedule(static)
+        for(int iz=s[2]; iz<e[2]; iz++)
+            for (int p = 0; p < TGrid::NVAR; ++p)
+            {
+                Real * const phalo = halo[p];
+                const Real * const psrc = pdata[p];
 
-            for(int iz=s[2]; iz<e[2]; iz++)
                 for(int iy=s[1]; iy<e[1]; iy++)
                     for(int ix=s[0]; ix<e[0]; ix++)
                     {
-                        // iz-startZ to operate on an arbitrary chunk
-                        phalo[map(ix, iy, iz-startZ)] = (*this)(psrc,
+                        // iz-oz to operate on an arbitrary chunk
+                        phalo[map(ix, iy, iz-oz)] = (*this)(psrc,
                                 dir==0? (side==0? 0:TGrid::sizeX-1):ix,
                                 dir==1? (side==0? 0:TGrid::sizeY-1):iy,
                                 dir==2? (side==0? 0:TGrid::sizeZ-1):iz);
                     }
-        }
+            }
     }
 
 
     template<int dir, int side, index_map map>
     void applyBC_reflecting(RealPtrVec_t& halo)
     {
+        if (!_in_chunk<dir,side>()) return;
         _setup<dir>();
 
         const Real fac[TGrid::NVAR] = {1, ((dir==0)? -1:1), ((dir==1)? -1:1), ((dir==2)? -1:1), 1, 1, 1};
 
-#pragma omp parallel for
-        for (int p = 0; p < TGrid::NVAR; ++p)
-        {
-            Real * const phalo = halo[p];
-            const Real * const psrc = pdata[p];
+#pragma omp parallel for collapse(2) schedule(static)
+        for(int iz=s[2]; iz<e[2]; iz++)
+            for (int p = 0; p < TGrid::NVAR; ++p)
+            {
+                Real * const phalo = halo[p];
+                const Real * const psrc = pdata[p];
 
-            for(int iz=s[2]; iz<e[2]; iz++)
                 for(int iy=s[1]; iy<e[1]; iy++)
                     for(int ix=s[0]; ix<e[0]; ix++)
                     {
-                        // iz-startZ to operate on an arbitrary chunk
-                        phalo[map(ix, iy, iz-startZ)] = fac[p] * (*this)(psrc,
+                        // iz-oz to operate on an arbitrary chunk
+                        phalo[map(ix, iy, iz-oz)] = fac[p] * (*this)(psrc,
                                 dir==0? (side==0? 2-ix:TGrid::sizeX-1-ix):ix,
                                 dir==1? (side==0? 2-iy:TGrid::sizeY-1-iy):iy,
                                 dir==2? (side==0? 2-iz:TGrid::sizeZ-1-iz):iz);
                     }
-        }
+            }
     }
 
     /* template<int dir, int side> */
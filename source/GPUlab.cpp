@@ -10,6 +10,7 @@
 #include "Update_CUDA.h"
 
 #include <string>
+#include <algorithm>
 using std::string;
 
 #ifdef _USE_HDF_
@@ -26,13 +27,15 @@ GPUlab::GPUlab(GridMPI& G, const uint_t nslices_, const int verbosity) :
     GPU_input_size( SLICE_GPU * (nslices_+6) ),
     GPU_output_size( SLICE_GPU * nslices_ ),
     nslices(nslices_), nslices_last( sizeZ % nslices_ ), nchunks( (sizeZ + nslices_ - 1) / nslices_ ),
-    cart_world(G.getCartComm()), request(6), status(6),
+    cart_world(G.getCartComm()), request(6, MPI_REQUEST_NULL), status(6),
+    recv_request(6, MPI_REQUEST_NULL), recv_status(6),
     BUFFER1(GPU_input_size, GPU_output_size, 3*sizeY*nslices_, sizeX*3*nslices_), // per chunk
     BUFFER2(GPU_input_size, GPU_output_size, 3*sizeY*nslices_, sizeX*3*nslices_), // per chunk
     grid(G),
-    halox(3*sizeY*sizeZ), // all domain (buffer zone for halo extraction + MPI send/recv)
-    haloy(sizeX*3*sizeZ), // all domain
-    haloz(sizeX*sizeY*3)  // all domain
+    halox(3*sizeY*sizeZ, false), // all domain (buffer zone for halo extraction + MPI send/recv), unless streamed
+    haloy(sizeX*3*sizeZ, false), // all domain, unless streamed
+    haloz(sizeX*sizeY*3), // all domain
+    bc_iz(0), bc_nslices(sizeZ)
 {
     if (nslices_last != 0) // can be solved later
     {
@@ -48,6 +51,7 @@ GPUlab::GPUlab(GridMPI& G, const uint_t nslices_, const int verbosity) :
 
     chatty = QUIET;
     if (2 == verbosity) chatty = VERBOSE;
+    tmp_monitor = verbosity > 0 && tmp_reduced();
 
     _alloc_GPU();
 
@@ -68,36 +72,73 @@ GPUlab::GPUlab(GridMPI& G, const uint_t nslices_, const int verbosity) :
         myFeature[i*2 + 1] = mycoords[i] == grid.getBlocksPerDimension(i)-1 ? SKIN : FLESH;
     }
     grid.getNeighborRanks(nbr);
+
+    halo_mode = P2P;
+    node_comm = MPI_COMM_NULL;
+    shm_win   = MPI_WIN_NULL;
+    rma_win   = MPI_WIN_NULL;
+    rma_group = MPI_GROUP_NULL;
+    nbr_comm  = MPI_COMM_NULL;
+    nbr_request = MPI_REQUEST_NULL;
+    halo_encoding = HaloEncoder::NONE;
+    halo_rawbytes = halo_msgbytes = 0;
+    halo_stream = false;
+    xyhalos_sized = false;
+    bc_time = 0;
+    for (int i = 0; i < 4; ++i)
+        for (int s = 0; s < 2; ++s)
+            stream_sreq[i][s] = stream_rreq[i][s] = MPI_REQUEST_NULL;
+    tmp_maxerr = tmp_maxval = 0;
+    uint_t allfaces = 0;
+    for (int i = 0; i < 6; ++i)
+    {
+        Halo& h = _face_halo(i);
+        sendbuf[i] = (i < 4) ? NULL : ((i & 1) ? &h.send_right[0] : &h.send_left[0]);
+        shm_nbr[i] = false;
+        face_offset[i] = allfaces;
+        allfaces += h.Allhalos;
+    }
+
+    halo_bytes = 0;
+    _account_halos();
+    const HostBuffer * const buf[2] = {&BUFFER1, &BUFFER2};
+    buffer_bytes = 0;
+    for (int i = 0; i < 2; ++i)
+        buffer_bytes += sizeof(Real) * (buf[i]->GPUin_all.size() + buf[i]->GPUtmp_all.size() + buf[i]->GPUout_all.size() + buf[i]->xyghost_all.size());
+    HostMemory::allocate(HostMemory::BUFFERS, buffer_bytes);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // PRIVATE
 ///////////////////////////////////////////////////////////////////////////////
 template <index_map map>
-void GPUlab::_copysend_halos(const int sender, Real * const cpybuf, const uint_t Nhalos, const int xS, const int xE, const int yS, const int yE, const int zS, const int zE)
+void GPUlab::_copy_halos(Real * const cpybuf, const uint_t Nhalos, const int xS, const int xE, const int yS, const int yE, const int zS, const int zE)
 {
     assert(Nhalos == (xE-xS)*(yE-yS)*(zE-zS));
 
-#pragma omp parallel for
-    for (int p = 0; p < GridMPI::NVAR; ++p)
-    {
-        const Real * const src = grid.pdata()[p];
-        const uint_t offset = p * Nhalos;
-        for (int iz = zS; iz < zE; ++iz)
+#pragma omp parallel for collapse(2) schedule(static)
+    for (int iz = zS; iz < zE; ++iz)
+        for (int p = 0; p < GridMPI::NVAR; ++p)
+        {
+            const Real * const src = grid.pdata()[p];
+            const uint_t offset = p * Nhalos;
             for (int iy = yS; iy < yE; ++iy)
                 for (int ix = xS; ix < xE; ++ix)
-                    cpybuf[offset + map(ix,iy,iz-zS)] = src[ix + sizeX * (iy + sizeY * iz)];
-    }
-
-    // farewell, brother
-    _issue_send(cpybuf, GridMPI::NVAR * Nhalos, sender);
+                    cpybuf[offset + map(ix,iy,iz-zS)] = src[GridMPI::linaccess(ix,iy,iz)];
+        }
 }
 
 
-void GPUlab::_copysend_halos(const int sender, Real * const cpybuf, const uint_t Nhalos, const int zS)
+void GPUlab::_copy_halos(Real * const cpybuf, const uint_t Nhalos, const int zS)
 {
     assert(Nhalos == 3*SLICE_GPU);
 
+    if (!GridMPI::Layout::linear)
+    {
+        _copy_halos<ghostmap::Z>(cpybuf, Nhalos, 0, sizeX, 0, sizeY, zS, zS+3);
+        return;
+    }
+
     const uint_t srcoffset = SLICE_GPU * zS;
 #pragma omp parallel for
     for (int p = 0; p < GridMPI::NVAR; ++p)
@@ -106,9 +147,421 @@ void GPUlab::_copysend_halos(const int sender, Real * const cpybuf, const uint_t
         const uint_t offset = p * Nhalos;
         memcpy(cpybuf + offset, src + srcoffset, Nhalos*sizeof(Real));
     }
+}
+
+
+void GPUlab::_copy_halos(const int face, Real * const cpybuf, const int zS, const int zE)
+{
+    // x/y faces of the slices [zS,zE), z faces are always complete
+    const uint_t nz = zE - zS;
+    switch (face)
+    {
+        case 0: _copy_halos<flesh2ghost::X_L>(cpybuf, 3*sizeY*nz, 0, 3, 0, sizeY, zS, zE); break;
+        case 1: _copy_halos<flesh2ghost::X_R>(cpybuf, 3*sizeY*nz, sizeX-3, sizeX, 0, sizeY, zS, zE); break;
+        case 2: _copy_halos<flesh2ghost::Y_L>(cpybuf, sizeX*3*nz, 0, sizeX, 0, 3, zS, zE); break;
+        case 3: _copy_halos<flesh2ghost::Y_R>(cpybuf, sizeX*3*nz, 0, sizeX, sizeY-3, sizeY, zS, zE); break;
+        case 4: _copy_halos(cpybuf, haloz.Nhalo, 0); break;
+        case 5: _copy_halos(cpybuf, haloz.Nhalo, sizeZ-3); break;
+    }
+}
+
+
+void GPUlab::_init_shm_halos()
+{
+    /* *
+     * Every rank exposes its six extracted faces in a shared memory window
+     * of its node.  For neighbors on the same node, the halo pointers
+     * (Halo::left/right) are redirected into the neighbor's window, which
+     * avoids the pack/MPI/unpack copies.  Faces of neighbors on other nodes
+     * are still communicated with MPI.
+     * */
+    MPI_Comm_split_type(cart_world, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+
+    const uint_t allfaces = face_offset[5] + haloz.Allhalos;
+    Real *mywin;
+    MPI_Win_allocate_shared(allfaces*sizeof(Real), sizeof(Real), MPI_INFO_NULL, node_comm, &mywin, &shm_win);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, shm_win);
+
+    for (int i = 0; i < 6; ++i)
+        sendbuf[i] = mywin + face_offset[i];
+
+    // neighbor ranks in the node communicator (MPI_UNDEFINED if off-node)
+    int node_nbr[6];
+    MPI_Group cart_group, node_group;
+    MPI_Comm_group(cart_world, &cart_group);
+    MPI_Comm_group(node_comm, &node_group);
+    MPI_Group_translate_ranks(cart_group, 6, nbr, node_group, node_nbr);
+    MPI_Group_free(&cart_group);
+    MPI_Group_free(&node_group);
+
+    int nshm = 0;
+    for (int i = 0; i < 6; ++i)
+    {
+        shm_nbr[i] = (myFeature[i] == FLESH && node_nbr[i] != MPI_UNDEFINED);
+        if (!shm_nbr[i]) continue;
+
+        MPI_Aint size;
+        int disp_unit;
+        Real *nbrwin;
+        MPI_Win_shared_query(shm_win, node_nbr[i], &size, &disp_unit, &nbrwin);
+
+        // the neighbor extracts our halo through its opposite face
+        _point_halos(i, nbrwin + face_offset[i ^ 1]);
+        ++nshm;
+    }
+
+    if (chatty)
+        printf("[GPUlab: %d of 6 halos through shared memory]\n", nshm);
+}
+
+
+void GPUlab::_init_rma_halos()
+{
+    /* *
+     * The receive halos of all six faces live in one MPI window (with the
+     * same layout as the shared memory window).  Neighbors MPI_Put their
+     * faces directly into it, no receive-side matching is involved.
+     * */
+    const uint_t allfaces = face_offset[5] + haloz.Allhalos;
+    Real *mywin;
+    MPI_Win_allocate(allfaces*sizeof(Real), sizeof(Real), MPI_INFO_NULL, cart_world, &mywin, &rma_win);
+
+    for (int i = 0; i < 6; ++i)
+        _point_halos(i, mywin + face_offset[i]);
+
+    // access and exposure group: neighbors across FLESH faces
+    int members[6];
+    int nmembers = 0;
+    for (int i = 0; i < 6; ++i)
+        if (myFeature[i] == FLESH && std::find(members, members+nmembers, nbr[i]) == members+nmembers)
+            members[nmembers++] = nbr[i];
+
+    MPI_Group cart_group;
+    MPI_Comm_group(cart_world, &cart_group);
+    MPI_Group_incl(cart_group, nmembers, members, &rma_group);
+    MPI_Group_free(&cart_group);
+}
+
+
+void GPUlab::_init_nbr_halos()
+{
+    /* *
+     * MPI_Ineighbor_alltoallw on a distributed graph of cart_world (same
+     * ranks) restricted to the interior (FLESH) faces.  With the plain
+     * cartesian neighborhood, periodic directions with 2 processes have the
+     * same rank on both sides and SKIN faces would send empty messages,
+     * which makes the matching of the messages ambiguous.
+     * A face datatype selects the 3-deep face of all NVAR arrays in the
+     * grid directly (absolute addresses, MPI_BOTTOM), its element order
+     * matches ghostmap, hence no extraction copy is needed.  Halos are
+     * received into the Halo recv buffers.
+     * */
+    const int sizes[3] = {(int)sizeZ, (int)sizeY, (int)sizeX};
+    int nbr_ranks[6];
+    nbr_count = 0;
+    for (int i = 0; i < 6; ++i)
+    {
+        const int dir = 2 - i/2; // C-order index of the face normal
+        int subsizes[3] = {(int)sizeZ, (int)sizeY, (int)sizeX};
+        int starts[3]   = {0, 0, 0};
+        subsizes[dir] = 3;
+        starts[dir]   = (i & 1) ? sizes[dir]-3 : 0;
+
+        MPI_Datatype subarray;
+        MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, _MPI_REAL_, &subarray);
+
+        int blocklen[GridMPI::NVAR];
+        MPI_Aint displ[GridMPI::NVAR];
+        MPI_Datatype types[GridMPI::NVAR];
+        for (int p = 0; p < GridMPI::NVAR; ++p)
+        {
+            blocklen[p] = 1;
+            types[p]    = subarray;
+            MPI_Get_address(grid.pdata()[p], &displ[p]);
+        }
+        MPI_Type_create_struct(GridMPI::NVAR, blocklen, displ, types, &face_type[i]);
+        MPI_Type_commit(&face_type[i]);
+        MPI_Type_free(&subarray);
+
+        if (myFeature[i] == SKIN) continue;
+
+        const int k = nbr_count++;
+        Halo& h = _face_halo(i);
+        nbr_ranks[k]     = nbr[i];
+        nbr_sendcount[k] = 1;
+        nbr_sdispl[k]    = 0;
+        nbr_recvcount[k] = h.Allhalos;
+        nbr_recvtype[k]  = _MPI_REAL_;
+        MPI_Get_address((i & 1) ? &h.recv_right[0] : &h.recv_left[0], &nbr_rdispl[k]);
+    }
+
+    // send types in the order of the active faces
+    int k = 0;
+    for (int i = 0; i < 6; ++i)
+        if (myFeature[i] == FLESH)
+            nbr_sendtype[k++] = face_type[i];
+
+    MPI_Dist_graph_create_adjacent(cart_world, nbr_count, nbr_ranks, MPI_UNWEIGHTED,
+            nbr_count, nbr_ranks, MPI_UNWEIGHTED, MPI_INFO_NULL, 0, &nbr_comm);
+}
+
+
+void GPUlab::_point_halos(const int face, const Real * const base)
+{
+    // redirect the halo of a face to an external buffer (NULL = own recv buffer)
+    Halo& h = _face_halo(face);
+    RealPtrVec_t& halo = (face & 1) ? h.right : h.left;
+    std::vector<Real>& recv = (face & 1) ? h.recv_right : h.recv_left;
+    Real * const dst = (base == NULL) ? &recv[0] : const_cast<Real *>(base);
+    for (int p = 0; p < GridMPI::NVAR; ++p)
+        halo[p] = dst + p * h.Nhalo;
+}
+
+
+void GPUlab::_free_halo_exchange()
+{
+    switch (halo_mode)
+    {
+        case SHM:
+            MPI_Win_unlock_all(shm_win);
+            MPI_Win_free(&shm_win);
+            MPI_Comm_free(&node_comm);
+            break;
+
+        case RMA:
+            MPI_Group_free(&rma_group);
+            MPI_Win_free(&rma_win);
+            break;
+
+        case NBR:
+            for (int i = 0; i < 6; ++i)
+                MPI_Type_free(&face_type[i]);
+            MPI_Comm_free(&nbr_comm);
+            break;
+
+        case P2P:
+            break;
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        shm_nbr[i] = false;
+        if (halo_stream && i < 4) continue; // no all domain buffers
+        Halo& h = _face_halo(i);
+        sendbuf[i] = (i & 1) ? &h.send_right[0] : &h.send_left[0];
+        _point_halos(i, NULL);
+    }
+}
+
+
+void GPUlab::_stream_point(const int slot)
+{
+    // x/y halos of the chunk in ring slot
+    for (int i = 0; i < 4; ++i)
+    {
+        Halo& h = _face_halo(i);
+        RealPtrVec_t& halo = (i & 1) ? h.right : h.left;
+        Real * const base = &stream_recv[i][slot][0];
+        const uint_t Nhalo = stream_recv[i][slot].size() / GridMPI::NVAR;
+        for (int p = 0; p < GridMPI::NVAR; ++p)
+            halo[p] = base + p * Nhalo;
+    }
+}
+
+
+void GPUlab::_stream_post(const uint_t chunk)
+{
+    /* *
+     * Exchange the x/y faces of the slices of chunk (and apply the BC's on
+     * them).  Two chunks are in flight at most, the slot of chunk is free
+     * once the sends of chunk-2 are done.
+     * */
+    const int slot = chunk % 2;
+    const uint_t iz = chunk * nslices;
+
+    for (int i = 0; i < 4; ++i)
+        if (myFeature[i] == FLESH)
+        {
+            MPI_Wait(&stream_sreq[i][slot], MPI_STATUS_IGNORE);
+            MPI_Irecv(&stream_recv[i][slot][0], stream_recv[i][slot].size(), _MPI_REAL_, nbr[i], i ^ 1, cart_world, &stream_rreq[i][slot]);
+        }
+
+    for (int i = 0; i < 4; ++i)
+        if (myFeature[i] == FLESH)
+        {
+            std::vector<Real>& buf = stream_send[i][slot];
+            _copy_halos(i, &buf[0], iz, iz + nslices);
+            MPI_Isend(&buf[0], buf.size(), _MPI_REAL_, nbr[i], i, cart_world, &stream_sreq[i][slot]);
+            halo_rawbytes += buf.size() * sizeof(Real);
+            halo_msgbytes += buf.size() * sizeof(Real);
+        }
+
+    // SKIN faces of the chunk (z halos with the first and last chunk)
+    _stream_point(slot);
+    bc_iz = iz;
+    bc_nslices = nslices;
+    _apply_bc(bc_time);
+    bc_iz = 0;
+    bc_nslices = sizeZ;
+}
+
+
+void GPUlab::_stream_wait(const uint_t chunk)
+{
+    const int slot = chunk % 2;
+    for (int i = 0; i < 4; ++i)
+        MPI_Wait(&stream_rreq[i][slot], MPI_STATUS_IGNORE);
+    _stream_point(slot);
+}
+
+
+void GPUlab::_free_halo_stream()
+{
+    if (!halo_stream) return;
+
+    // pending receives exist if process_all() did not follow load_ghosts()
+    for (int i = 0; i < 4; ++i)
+        for (int s = 0; s < 2; ++s)
+        {
+            if (MPI_REQUEST_NULL != stream_rreq[i][s])
+                MPI_Cancel(&stream_rreq[i][s]);
+            MPI_Wait(&stream_rreq[i][s], MPI_STATUS_IGNORE);
+            MPI_Wait(&stream_sreq[i][s], MPI_STATUS_IGNORE);
+        }
+}
+
 
-    // au revoir, soeur jumelle
-    _issue_send(cpybuf, GridMPI::NVAR * Nhalos, sender);
+void GPUlab::_post_halos()
+{
+    switch (halo_mode)
+    {
+        case SHM:
+            // same-node neighbors must be done reading our faces from the
+            // previous exchange
+            _shm_sync();
+            // fall through
+        case P2P:
+            // x/yhalos directly into pinned mem and H2D
+            for (int i = halo_stream ? 4 : 0; i < 6; ++i)
+                if (myFeature[i] == FLESH && !shm_nbr[i])
+                {
+                    Halo& h = _face_halo(i);
+                    if (HaloEncoder::NONE == halo_encoding)
+                        _issue_recv((i & 1) ? &h.recv_right[0] : &h.recv_left[0], h.Allhalos, i);
+                    else
+                        _issue_recv(&enc_recv[i][0], enc_recv[i].size(), i);
+                }
+            break;
+
+        case RMA:
+            MPI_Win_post(rma_group, 0, rma_win);
+            MPI_Win_start(rma_group, 0, rma_win);
+            break;
+
+        case NBR:
+            MPI_Ineighbor_alltoallw(MPI_BOTTOM, nbr_sendcount, nbr_sdispl, nbr_sendtype,
+                    MPI_BOTTOM, nbr_recvcount, nbr_rdispl, nbr_recvtype, nbr_comm, &nbr_request);
+            break;
+    }
+}
+
+
+void GPUlab::_send_halo(const int face)
+{
+    // extract the face, except for the neighborhood collective which reads
+    // the grid directly
+    if (NBR == halo_mode) return;
+    _copy_halos(face, sendbuf[face]);
+
+    switch (halo_mode)
+    {
+        case SHM:
+            if (shm_nbr[face]) break;
+            // fall through
+        case P2P:
+            {
+                const Halo& h = _face_halo(face);
+                halo_rawbytes += h.Allhalos * sizeof(Real);
+                if (HaloEncoder::NONE == halo_encoding)
+                {
+                    _issue_send(sendbuf[face], h.Allhalos, face); // farewell, brother
+                    halo_msgbytes += h.Allhalos * sizeof(Real);
+                }
+                else
+                {
+                    const size_t nbytes = HaloEncoder::encode(sendbuf[face], h.Nhalo, GridMPI::NVAR, &enc_send[face][0], halo_encoding);
+                    _issue_send(&enc_send[face][0], nbytes, face);
+                    halo_msgbytes += nbytes;
+                }
+                break;
+            }
+
+        case RMA:
+            _issue_put(sendbuf[face], _face_halo(face).Allhalos, face);
+            break;
+
+        case NBR: // returned above
+            break;
+    }
+}
+
+
+void GPUlab::_wait_halos()
+{
+    switch (halo_mode)
+    {
+        case P2P:
+        case SHM:
+            if (HaloEncoder::NONE == halo_encoding)
+                MPI_Waitall(6, &recv_request[0], &recv_status[0]);
+            else
+                _decode_halos();
+            MPI_Waitall(6, &request[0], &status[0]); // send buffers are reused in the next exchange
+            if (SHM == halo_mode) _shm_sync(); // faces of same-node neighbors are ready
+            break;
+
+        case RMA:
+            MPI_Win_complete(rma_win);
+            MPI_Win_wait(rma_win);
+            break;
+
+        case NBR:
+            MPI_Wait(&nbr_request, MPI_STATUS_IGNORE);
+            break;
+    }
+}
+
+
+void GPUlab::_decode_halos()
+{
+    // decode the encoded halos in the order they arrive
+    for (int n = 0; n < 6; ++n)
+    {
+        int i;
+        MPI_Waitany(6, &recv_request[0], &i, MPI_STATUS_IGNORE);
+        if (MPI_UNDEFINED == i) break;
+
+        Halo& h = _face_halo(i);
+        HaloEncoder::decode(&enc_recv[i][0], h.Nhalo, GridMPI::NVAR, (i & 1) ? &h.recv_right[0] : &h.recv_left[0], halo_encoding);
+    }
+}
+
+
+void GPUlab::_account_halos()
+{
+    size_t bytes = 0;
+    for (int i = 0; i < 6; ++i)
+    {
+        const Halo& h = _face_halo(i);
+        const std::vector<Real>& send = (i & 1) ? h.send_right : h.send_left;
+        const std::vector<Real>& recv = (i & 1) ? h.recv_right : h.recv_left;
+        bytes += sizeof(Real) * (send.capacity() + recv.capacity());
+        bytes += enc_send[i].capacity() + enc_recv[i].capacity();
+    }
+    for (int i = 0; i < 4; ++i)
+        for (int s = 0; s < 2; ++s)
+            bytes += sizeof(Real) * (stream_send[i][s].capacity() + stream_recv[i][s].capacity());
+    HostMemory::resize(HostMemory::HALOS, halo_bytes, bytes);
 }
 
 
@@ -186,9 +639,8 @@ void GPUlab::_process_chunk_sos(const RealPtrVec_t& src)
     ///////////////////////////////////////////////////////////////////
     // 4.)
     ///////////////////////////////////////////////////////////////////
-    const uint_t OFFSET = SLICE_GPU * curr_iz;
     timer.start();
-    _copy_range(curr_buffer->GPUin, 0, src, OFFSET, SLICE_GPU * curr_slices);
+    _gather_slices(curr_buffer->GPUin, 0, src, curr_iz, curr_slices);
     const double t1 = timer.stop();
     if (chatty) printf("\t[COPY SRC CHUNK %d TAKES %f sec]\n", curr_chunk_id, t1);
 
@@ -199,7 +651,7 @@ void GPUlab::_process_chunk_sos(const RealPtrVec_t& src)
 }
 
 
-void GPUlab::_process_chunk_flow(const Real a, const Real b, const Real dtinvh, RealPtrVec_t& src, RealPtrVec_t& tmp)
+void GPUlab::_process_chunk_flow(const Real a, const Real b, const Real dtinvh, RealPtrVec_t& src, TmpPtrVec_t& tmp)
 {
     /* *
      * Process chunk for the RHS computation:
@@ -221,9 +673,8 @@ void GPUlab::_process_chunk_flow(const Real a, const Real b, const Real dtinvh,
     ///////////////////////////////////////////////////////////////////
     // 1.)
     ///////////////////////////////////////////////////////////////////
-    uint_t OFFSET = SLICE_GPU * curr_iz;
     timer.start();
-    _copy_range(curr_buffer->GPUtmp, 0, tmp, OFFSET, SLICE_GPU * curr_slices);
+    _gather_slices(curr_buffer->GPUtmp, 0, tmp, curr_iz, curr_slices);
     const double t1 = timer.stop();
     if (chatty)
         printf("\t[COPY TMP CHUNK %d TAKES %f sec]\n", curr_chunk_id, t1);
@@ -261,18 +712,17 @@ void GPUlab::_process_chunk_flow(const Real a, const Real b, const Real dtinvh,
         // _process_chunk has finished processing all chunks.
         case INTERMEDIATE:
         case LAST: // operations are on chunk one before LAST (because of use of previous_buffer)!
-            const uint_t prevOFFSET = SLICE_GPU * prev_iz;
-
             GPU::d2h_rhs_wait(); // make sure previous d2h has finished
             timer.start();
-            _copy_range(tmp, prevOFFSET, prev_buffer->GPUtmp, 0, SLICE_GPU * prev_slices);
+            _scatter_slices(tmp, prev_iz, prev_buffer->GPUtmp, 0, prev_slices);
+            if (tmp_monitor) _monitor_tmp(prev_buffer->GPUtmp, 0, prev_slices);
             const double t4 = timer.stop();
             if (chatty)
                 printf("\t[COPY BACK TMP CHUNK %d TAKES %f sec]\n", prev_chunk_id, t4);
 
             GPU::d2h_tmp_wait();
             timer.start();
-            _copy_range(src, prevOFFSET, prev_buffer->GPUout, 0, SLICE_GPU * prev_slices);
+            _scatter_slices(src, prev_iz, prev_buffer->GPUout, 0, prev_slices);
             const double t2 = timer.stop();
             if (chatty)
                 printf("\t[COPY BACK OUTPUT CHUNK %d TAKES %f sec]\n", prev_chunk_id, t2);
@@ -295,8 +745,6 @@ void GPUlab::_process_chunk_flow(const Real a, const Real b, const Real dtinvh,
     ///////////////////////////////////////////////////////////////////
     // 7.)
     ///////////////////////////////////////////////////////////////////
-    OFFSET = SLICE_GPU * curr_iz;
-
     timer.start();
     switch (chunk_state)
     {
@@ -316,7 +764,7 @@ void GPUlab::_process_chunk_flow(const Real a, const Real b, const Real dtinvh,
                 _copy_range(curr_buffer->GPUin, 0, prev_buffer->GPUin, prevOFFSET, haloz.Nhalo);
 
                 // interior + right ghosts
-                _copy_range(curr_buffer->GPUin, haloz.Nhalo, src, OFFSET, SLICE_GPU * curr_slices + haloz.Nhalo);
+                _gather_slices(curr_buffer->GPUin, haloz.Nhalo, src, curr_iz, curr_slices + 3);
                 break;
             }
 
@@ -327,7 +775,7 @@ void GPUlab::_process_chunk_flow(const Real a, const Real b, const Real dtinvh,
                 _copy_range(curr_buffer->GPUin, 0, prev_buffer->GPUin, prevOFFSET, haloz.Nhalo);
 
                 // interior
-                _copy_range(curr_buffer->GPUin, haloz.Nhalo, src, OFFSET, SLICE_GPU * curr_slices);
+                _gather_slices(curr_buffer->GPUin, haloz.Nhalo, src, curr_iz, curr_slices);
 
                 // right ghosts
                 const uint_t current_rightOFFSET = haloz.Nhalo + SLICE_GPU * curr_slices;
@@ -536,7 +984,6 @@ void GPUlab::_dump_chunk(const int complete)
     status = H5Dclose(dataset_id);
     status = H5Pclose(fapl_id);
     status = H5Fclose(file_id);
-    H5close();
 
     delete [] array_all;
 
@@ -619,28 +1066,172 @@ void GPUlab::_start_info_current_chunk(const std::string title)
 ///////////////////////////////////////////////////////////////////////////////
 // PUBLIC
 ///////////////////////////////////////////////////////////////////////////////
+void GPUlab::set_halo_exchange(const std::string mode)
+{
+    /* *
+     * Collective over cart_world.  Modes:
+     * p2p: MPI_Isend/MPI_Irecv for all six faces (default)
+     * shm: read faces of same-node neighbors out of an MPI-3 shared memory
+     *      window, p2p for neighbors on other nodes
+     * rma: neighbors MPI_Put their faces into our halo window
+     * nbr: MPI_Ineighbor_alltoallw on cart_world, one request for all faces
+     * */
+    if (halo_stream && mode != "p2p")
+    {
+        fprintf(stderr, "[GPUlab ERROR: Halo exchange mode %s can not be used with streamed halos\n", mode.c_str());
+        exit(1);
+    }
+
+    _free_halo_exchange();
+    halo_mode = P2P;
+    if (mode != "p2p") _size_xyhalos(); // not streamed
+
+    if (mode == "shm")
+    {
+        halo_mode = SHM;
+        _init_shm_halos();
+    }
+    else if (mode == "rma")
+    {
+        halo_mode = RMA;
+        _init_rma_halos();
+    }
+    else if (mode == "nbr")
+    {
+        if (!GridMPI::Layout::linear)
+        {
+            fprintf(stderr, "[GPUlab ERROR: Halo exchange mode nbr requires the linear grid layout\n");
+            exit(1);
+        }
+        halo_mode = NBR;
+        _init_nbr_halos();
+    }
+    else if (mode != "p2p")
+    {
+        fprintf(stderr, "[GPUlab ERROR: Unknown halo exchange mode %s\n", mode.c_str());
+        exit(1);
+    }
+}
+
+
+void GPUlab::set_halo_encoding(const std::string encoding)
+{
+    /* *
+     * Encoding of halo messages sent with MPI_Isend (-halo p2p, or to
+     * neighbors on other nodes with -halo shm):
+     * none:  raw Real values (default)
+     * float: down-conversion to float (lossy in double precision builds)
+     * fpc:   lossless floating-point compression, pays off for smooth halos
+     * */
+    if (encoding == "none")
+        halo_encoding = HaloEncoder::NONE;
+    else if (encoding == "float")
+        halo_encoding = HaloEncoder::FLOAT;
+    else if (encoding == "fpc")
+        halo_encoding = HaloEncoder::FPC;
+    else
+    {
+        fprintf(stderr, "[GPUlab ERROR: Unknown halo encoding %s\n", encoding.c_str());
+        exit(1);
+    }
+
+    if (HaloEncoder::NONE != halo_encoding && (RMA == halo_mode || NBR == halo_mode))
+    {
+        fprintf(stderr, "[GPUlab ERROR: Halo encoding %s requires -halo p2p or shm\n", encoding.c_str());
+        exit(1);
+    }
+
+    if (HaloEncoder::NONE != halo_encoding && halo_stream)
+    {
+        fprintf(stderr, "[GPUlab ERROR: Halo encoding %s can not be used with streamed halos\n", encoding.c_str());
+        exit(1);
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        const size_t bytes = (HaloEncoder::NONE == halo_encoding) ? 0 : HaloEncoder::bound(_face_halo(i).Nhalo, GridMPI::NVAR, halo_encoding);
+        std::vector<unsigned char>(bytes).swap(enc_send[i]);
+        std::vector<unsigned char>(bytes).swap(enc_recv[i]);
+    }
+    _account_halos();
+}
+
+
+void GPUlab::set_halo_stream(const bool stream)
+{
+    /* *
+     * Streamed x/y halos (-halo p2p, no encoding): the x/y faces of chunk k+1
+     * are exchanged while chunk k is processed, into a ring of two
+     * chunk-sized slots.  Replaces the all domain halox/haloy buffers, which
+     * saves host memory if nchunks > 2.  Those are only allocated here (or by
+     * the first exchange if this is never called), not at construction.
+     * */
+    if (stream == halo_stream && xyhalos_sized) return;
+
+    if (stream && (P2P != halo_mode || HaloEncoder::NONE != halo_encoding))
+    {
+        fprintf(stderr, "[GPUlab ERROR: Streamed halos require -halo p2p without encoding\n");
+        exit(1);
+    }
+
+    _free_halo_stream();
+    halo_stream = stream;
+    xyhalos_sized = true;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        Halo& h = _face_halo(i);
+        const uint_t all = stream ? 0 : h.Allhalos;
+        std::vector<Real>(all).swap((i & 1) ? h.send_right : h.send_left);
+        std::vector<Real>(all).swap((i & 1) ? h.recv_right : h.recv_left);
+
+        const uint_t slot = stream ? GridMPI::NVAR * (i < 2 ? 3*sizeY : sizeX*3) * nslices : 0;
+        for (int s = 0; s < 2; ++s)
+        {
+            std::vector<Real>(slot).swap(stream_send[i][s]);
+            std::vector<Real>(slot).swap(stream_recv[i][s]);
+            stream_sreq[i][s] = stream_rreq[i][s] = MPI_REQUEST_NULL;
+        }
+
+        if (!stream)
+        {
+            sendbuf[i] = (i & 1) ? &h.send_right[0] : &h.send_left[0];
+            _point_halos(i, NULL);
+        }
+        else
+            sendbuf[i] = NULL;
+    }
+
+    if (stream) _stream_point(0);
+    _account_halos();
+}
+
+
 void GPUlab::load_ghosts(const double t)
 {
-    // TODO: THIS NEEDS THOROUGH TESTING!
+    /* *
+     * All receives (or the RMA epoch) are posted before the halos are
+     * extracted, such that the six faces are in flight concurrently and the
+     * exchange costs one message latency per RK stage instead of six
+     * serialized ones.
+     * */
+    _size_xyhalos();
+    halo_rawbytes = halo_msgbytes = 0;
+    bc_time = t;
 
-    if (myFeature[0] == FLESH) _copysend_halos<flesh2ghost::X_L>(0, &halox.send_left[0], halox.Nhalo, 0, 3, 0, sizeY, 0, sizeZ);
-    if (myFeature[1] == FLESH) _copysend_halos<flesh2ghost::X_R>(1, &halox.send_right[0],halox.Nhalo, sizeX-3, sizeX, 0, sizeY, 0, sizeZ);
-    if (myFeature[2] == FLESH) _copysend_halos<flesh2ghost::Y_L>(2, &haloy.send_left[0], haloy.Nhalo, 0, sizeX, 0, 3, 0, sizeZ);
-    if (myFeature[3] == FLESH) _copysend_halos<flesh2ghost::Y_R>(3, &haloy.send_right[0],haloy.Nhalo, 0, sizeX, sizeY-3, sizeY, 0, sizeZ);
-    if (myFeature[4] == FLESH) _copysend_halos(4, &haloz.send_left[0], haloz.Nhalo, 0);
-    if (myFeature[5] == FLESH) _copysend_halos(5, &haloz.send_right[0],haloz.Nhalo, sizeZ-3);
+    _post_halos();
 
-    // need more digging here! TODO: use MPI_Irecv ? even better: hide MPI
-    // latency with communicating per chunk on the host.  With this you can
-    // hide MPI comm with GPU
-    if (myFeature[0] == FLESH) _issue_recv(&halox.recv_left[0],  halox.Allhalos, 0); // x/yhalos directly into pinned mem and H2D
-    if (myFeature[1] == FLESH) _issue_recv(&halox.recv_right[0], halox.Allhalos, 1);
-    if (myFeature[2] == FLESH) _issue_recv(&haloy.recv_left[0],  haloy.Allhalos, 2);
-    if (myFeature[3] == FLESH) _issue_recv(&haloy.recv_right[0], haloy.Allhalos, 3);
-    if (myFeature[4] == FLESH) _issue_recv(&haloz.recv_left[0],  haloz.Allhalos, 4); // receive into curr_buffer->zghost_l ? why not
-    if (myFeature[5] == FLESH) _issue_recv(&haloz.recv_right[0], haloz.Allhalos, 5);
+    // streamed x/y faces are sent per chunk, starting with the first one
+    for (int i = halo_stream ? 4 : 0; i < 6; ++i)
+        if (myFeature[i] == FLESH)
+            _send_halo(i);
 
-    _apply_bc(t); // BC's apply to all myFeature == SKIN
+    if (halo_stream)
+        _stream_post(0); // includes the BC's
+    else
+        _apply_bc(t); // BC's apply to all myFeature == SKIN (overlaps with MPI)
+
+    _wait_halos();
 }
 
 
@@ -668,7 +1259,7 @@ double GPUlab::max_sos(float& sos)
     ///////////////////////////////////////////////////////////////
     Timer timer;
     timer.start();
-    _copy_range(curr_buffer->GPUin, 0, src, 0, SLICE_GPU * curr_slices);
+    _gather_slices(curr_buffer->GPUin, 0, src, 0, curr_slices);
     const double t1 = timer.stop();
     if (chatty)
     {
@@ -711,7 +1302,8 @@ double GPUlab::process_all(const Real a, const Real b, const Real dtinvh)
      * */
 
     RealPtrVec_t& src = grid.pdata();
-    RealPtrVec_t& tmp = grid.ptmp();
+    TmpPtrVec_t& tmp = grid.ptmp();
+    tmp_maxerr = tmp_maxval = 0;
 
     Timer tall;
     tall.start();
@@ -736,21 +1328,21 @@ double GPUlab::process_all(const Real a, const Real b, const Real dtinvh)
     // 2.)
     ///////////////////////////////////////////////////////////////
     Timer timer;
-    uint_t Nelements = SLICE_GPU * curr_slices;
+    uint_t Nslices = curr_slices;
 
     // copy left ghosts always (CAN BE DONE BY MPI RECV)
     _copy_range(curr_buffer->GPUin, 0, haloz.left, 0, haloz.Nhalo);
     switch (chunk_state) // right ghosts are conditional
     {
-        case FIRST: Nelements += haloz.Nhalo; break;
+        case FIRST: Nslices += 3; break;
         case SINGLE:
-                    _copy_range(curr_buffer->GPUin, haloz.Nhalo + Nelements, haloz.right, 0, haloz.Nhalo);
+                    _copy_range(curr_buffer->GPUin, haloz.Nhalo + SLICE_GPU * Nslices, haloz.right, 0, haloz.Nhalo);
                     break;
     }
 
     // interior data
     timer.start();
-    _copy_range(curr_buffer->GPUin, haloz.Nhalo, src, 0, Nelements);
+    _gather_slices(curr_buffer->GPUin, haloz.Nhalo, src, 0, Nslices);
     const double t1 = timer.stop();
     if (chatty) printf("\t[COPY SRC CHUNK %d TAKES %f sec]\n", curr_chunk_id, t1);
 
@@ -769,12 +1361,11 @@ double GPUlab::process_all(const Real a, const Real b, const Real dtinvh)
     ///////////////////////////////////////////////////////////////
     // 5.)
     ///////////////////////////////////////////////////////////////
-    const uint_t prevOFFSET = SLICE_GPU * prev_iz;
-
     // GPU rhs into tmp (d2h finishes first for rhs)
     GPU::d2h_rhs_wait();
     timer.start();
-    _copy_range(tmp, prevOFFSET, prev_buffer->GPUtmp, 0, SLICE_GPU * prev_slices);
+    _scatter_slices(tmp, prev_iz, prev_buffer->GPUtmp, 0, prev_slices);
+    if (tmp_monitor) _monitor_tmp(prev_buffer->GPUtmp, 0, prev_slices);
     const double t2 = timer.stop();
     if (chatty)
         printf("\t[COPY BACK TMP CHUNK %d TAKES %f sec]\n", prev_chunk_id, t2);
@@ -782,7 +1373,7 @@ double GPUlab::process_all(const Real a, const Real b, const Real dtinvh)
     // GPU update into src (a.k.a updated flow data)
     GPU::d2h_tmp_wait();
     timer.start();
-    _copy_range(src, prevOFFSET, prev_buffer->GPUout, 0, SLICE_GPU * prev_slices);
+    _scatter_slices(src, prev_iz, prev_buffer->GPUout, 0, prev_slices);
     const double t3 = timer.stop();
     if (chatty)
         printf("\t[COPY BACK OUTPUT CHUNK %d TAKES %f sec]\n", prev_chunk_id, t3);
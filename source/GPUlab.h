@@ -10,6 +10,8 @@
 #include "GridMPI.h"
 #include "Types.h"
 #include "Timer.h"
+#include "HaloEncoder.h"
+#include "HostMemory.h"
 
 #include <mpi.h>
 #include <omp.h>
@@ -63,9 +65,62 @@ class GPUlab
         const MPI_Comm cart_world;
         std::vector<MPI_Request> request;
         std::vector<MPI_Status> status;
+        std::vector<MPI_Request> recv_request;
+        std::vector<MPI_Status> recv_status;
 
         int nbr[6]; // neighbor ranks
 
+        // halo exchange mode, see set_halo_exchange()
+        enum {P2P, SHM, RMA, NBR} halo_mode;
+        Real *sendbuf[6]; // extracted faces (Halo send buffers or shared window)
+        uint_t face_offset[6]; // face layout of halo windows (same on all ranks)
+
+        // MPI-3 shared memory: faces of neighbors on the same node are read
+        // straight out of their window, no MPI send/recv involved
+        MPI_Comm node_comm;
+        MPI_Win shm_win;
+        bool shm_nbr[6];
+
+        // one-sided: neighbors MPI_Put into our halos (post-start-complete-wait
+        // epoch over the neighbor group)
+        MPI_Win rma_win;
+        MPI_Group rma_group;
+
+        // neighborhood collective over the interior faces of cart_world: one
+        // request for all faces, faces are sent straight out of the grid with
+        // one datatype per face
+        MPI_Comm nbr_comm;
+        MPI_Request nbr_request;
+        int nbr_count;
+        MPI_Datatype face_type[6];
+        int nbr_sendcount[6], nbr_recvcount[6];
+        MPI_Aint nbr_sdispl[6], nbr_rdispl[6];
+        MPI_Datatype nbr_sendtype[6], nbr_recvtype[6];
+
+        // optional encoding of p2p halo messages, see set_halo_encoding()
+        HaloEncoder::Encoding halo_encoding;
+        std::vector<unsigned char> enc_send[6], enc_recv[6];
+        size_t halo_rawbytes, halo_msgbytes; // of the last exchange
+
+        // streaming x/y halos, see set_halo_stream(): the x/y faces are
+        // exchanged chunk by chunk into a ring of two chunk-sized slots
+        // instead of the all domain halox/haloy buffers
+        bool halo_stream;
+        bool xyhalos_sized; // x/y halo buffers allocated for halo_stream
+        std::vector<Real> stream_send[4][2], stream_recv[4][2];
+        MPI_Request stream_sreq[4][2], stream_rreq[4][2];
+        double bc_time; // of the current RK stage
+
+        // rounding of the reduced precision tmp register (TmpReal), of the
+        // last process_all(), only monitored if verbose
+        bool tmp_monitor;
+        Real tmp_maxerr, tmp_maxval;
+
+        // host memory accounted in HostMemory (halo buffers change with the
+        // exchange options)
+        size_t halo_bytes, buffer_bytes;
+        void _account_halos();
+
         struct Halo // hello halo
         {
             static const uint_t NVAR = GridMPI::NVAR; // number of variables in set
@@ -74,13 +129,14 @@ class GPUlab
             std::vector<Real> send_left, send_right; // for position x1 < x2, then x1 = buf_left, x2 = buf_right
             std::vector<Real> recv_left, recv_right;
             RealPtrVec_t left, right;
-            Halo(const uint_t sizeHalo) :
+            Halo(const uint_t sizeHalo, const bool alloc=true) :
                 Nhalo(sizeHalo), Allhalos(NVAR*sizeHalo),
-                send_left(NVAR*sizeHalo, 0.0),
-                send_right(NVAR*sizeHalo, 0.0),
-                recv_left(NVAR*sizeHalo, 0.0),  left(NVAR, NULL),
-                recv_right(NVAR*sizeHalo, 0.0), right(NVAR, NULL)
+                send_left(alloc ? NVAR*sizeHalo : 0, 0.0),
+                send_right(alloc ? NVAR*sizeHalo : 0, 0.0),
+                recv_left(alloc ? NVAR*sizeHalo : 0, 0.0),  left(NVAR, NULL),
+                recv_right(alloc ? NVAR*sizeHalo : 0, 0.0), right(NVAR, NULL)
             {
+                if (!alloc) return; // sized later, see GPUlab::set_halo_stream()
                 for (int i = 0; i < NVAR; ++i)
                 {
                     // for convenience
@@ -100,13 +156,61 @@ class GPUlab
 
         inline void _issue_recv(Real * const recvbuf, const uint_t Nelements, const uint_t receiver)
         {
-            MPI_Recv(recvbuf, Nelements, _MPI_REAL_, nbr[receiver], MPI_ANY_TAG, cart_world, &status[receiver]);
+            // the neighbor sends through its opposite face, which is the tag
+            // it uses (receiver ^ 1)
+            MPI_Irecv(recvbuf, Nelements, _MPI_REAL_, nbr[receiver], receiver ^ 1, cart_world, &recv_request[receiver]);
+        }
+
+        // encoded halos
+        inline void _issue_send(const unsigned char * const sendbuf, const size_t Nbytes, const uint_t sender)
+        {
+            MPI_Isend(const_cast<unsigned char * const>(sendbuf), Nbytes, MPI_BYTE, nbr[sender], sender, cart_world, &request[sender]);
+        }
+
+        inline void _issue_recv(unsigned char * const recvbuf, const size_t Nbytes, const uint_t receiver)
+        {
+            MPI_Irecv(recvbuf, Nbytes, MPI_BYTE, nbr[receiver], receiver ^ 1, cart_world, &recv_request[receiver]);
+        }
+
+        void _decode_halos();
+
+        inline void _issue_put(const Real * const sendbuf, const uint_t Nelements, const uint_t sender)
+        {
+            // the neighbor stores our face as its halo of the opposite face
+            MPI_Put(const_cast<Real * const>(sendbuf), Nelements, _MPI_REAL_, nbr[sender], face_offset[sender ^ 1], Nelements, _MPI_REAL_, rma_win);
+        }
+
+        void _post_halos();
+        void _send_halo(const int face);
+        void _wait_halos();
+
+        inline void _shm_sync()
+        {
+            MPI_Win_sync(shm_win);
+            MPI_Barrier(node_comm);
+            MPI_Win_sync(shm_win);
         }
 
+        void _init_shm_halos();
+        void _init_rma_halos();
+        void _init_nbr_halos();
+        void _point_halos(const int face, const Real * const base);
+        void _free_halo_exchange();
+
+        // the x/y halo buffers are only allocated once it is known whether
+        // they are streamed
+        inline void _size_xyhalos() { if (!xyhalos_sized) set_halo_stream(halo_stream); }
+
+        void _stream_post(const uint_t chunk);
+        void _stream_wait(const uint_t chunk);
+        void _stream_point(const int slot);
+        void _free_halo_stream();
+
         // Halo extraction
         template <index_map map>
-        void _copysend_halos(const int sender, Real * const cpybuf, const uint_t Nhalos, const int xS, const int xE, const int yS, const int yE, const int zS, const int zE);
-        void _copysend_halos(const int sender, Real * const cpybuf, const uint_t Nhalos, const int zS);
+        void _copy_halos(Real * const cpybuf, const uint_t Nhalos, const int xS, const int xE, const int yS, const int yE, const int zS, const int zE);
+        void _copy_halos(Real * const cpybuf, const uint_t Nhalos, const int zS);
+        void _copy_halos(const int face, Real * const cpybuf, const int zS = 0, const int zE = sizeZ);
 
 
         ///////////////////////////////////////////////////////////////////////
@@ -196,24 +300,126 @@ class GPUlab
         void _init_next_chunk();
         void _dump_chunk(const int complete = 0);
 
+        static inline bool _is_strided(const RealPtrVec_t& v, const uint_t stride)
+        {
+            for (int i = 1; i < GridMPI::NVAR; ++i)
+                if (v[i] != v[0] + i*stride) return false;
+            return true;
+        }
+
         inline void _copy_range(RealPtrVec_t& dst, const uint_t dstOFFSET, const RealPtrVec_t& src, const uint_t srcOFFSET, const uint_t Nelements)
         {
+            // whole variables in contiguous storage on both sides: one
+            // transfer
+            if (_is_strided(dst, Nelements) && _is_strided(src, Nelements))
+            {
+                memcpy(dst[0] + dstOFFSET, src[0] + srcOFFSET, GridMPI::NVAR*Nelements*sizeof(Real));
+                return;
+            }
             for (int i = 0; i < GridMPI::NVAR; ++i)
                 memcpy(dst[i] + dstOFFSET, src[i] + srcOFFSET, Nelements*sizeof(Real));
         }
 
+        // converting copy (reduced precision tmp register), the callers
+        // parallelize over z-slabs
+        template <typename TD, typename TS>
+        inline void _copy_range(std::vector<TD *>& dst, const uint_t dstOFFSET, const std::vector<TS *>& src, const uint_t srcOFFSET, const uint_t Nelements)
+        {
+            for (int i = 0; i < GridMPI::NVAR; ++i)
+            {
+                TD * const out = dst[i] + dstOFFSET;
+                const TS * const in = src[i] + srcOFFSET;
+                for (uint_t k = 0; k < Nelements; ++k)
+                    out[k] = static_cast<Real>(in[k]);
+            }
+        }
+
+        // staging of nslices z-slices starting at slice iz of the grid
+        // fields from/to the (lexicographic) chunk buffers, by z-slabs
+        template <typename T>
+        inline void _gather_slices(RealPtrVec_t& dst, const uint_t dstOFFSET, const std::vector<T *>& src, const uint_t iz, const uint_t nslices)
+        {
+            if (GridMPI::Layout::linear)
+            {
+#pragma omp parallel for schedule(static)
+                for (int z = 0; z < (int)nslices; ++z)
+                    _copy_range(dst, dstOFFSET + SLICE_GPU * z, src, SLICE_GPU * (iz + z), SLICE_GPU);
+                return;
+            }
+#pragma omp parallel for schedule(static)
+            for (int z = 0; z < (int)nslices; ++z)
+                for (int p = 0; p < GridMPI::NVAR; ++p)
+                {
+                    Real * const out = dst[p] + dstOFFSET + SLICE_GPU * z;
+                    for (unsigned int y = 0; y < sizeY; ++y)
+                        for (unsigned int x = 0; x < sizeX; ++x)
+                            out[x + sizeX * y] = static_cast<Real>(src[p][GridMPI::linaccess(x, y, iz + z)]);
+                }
+        }
+
+        template <typename T>
+        inline void _scatter_slices(std::vector<T *>& dst, const uint_t iz, const RealPtrVec_t& src, const uint_t srcOFFSET, const uint_t nslices)
+        {
+            if (GridMPI::Layout::linear)
+            {
+#pragma omp parallel for schedule(static)
+                for (int z = 0; z < (int)nslices; ++z)
+                    _copy_range(dst, SLICE_GPU * (iz + z), src, srcOFFSET + SLICE_GPU * z, SLICE_GPU);
+                return;
+            }
+#pragma omp parallel for schedule(static)
+            for (int z = 0; z < (int)nslices; ++z)
+                for (int p = 0; p < GridMPI::NVAR; ++p)
+                {
+                    const Real * const in = src[p] + srcOFFSET + SLICE_GPU * z;
+                    for (unsigned int y = 0; y < sizeY; ++y)
+                        for (unsigned int x = 0; x < sizeX; ++x)
+                            dst[p][GridMPI::linaccess(x, y, iz + z)] = in[x + sizeX * y];
+                }
+        }
+
+        // rounding error of the reduced precision tmp register (monitoring)
+        // of nslices z-slices of the chunk buffer src
+        inline void _monitor_tmp(const RealPtrVec_t& src, const uint_t srcOFFSET, const uint_t nslices)
+        {
+            Real maxerr = tmp_maxerr, maxval = tmp_maxval;
+#pragma omp parallel for schedule(static) reduction(max:maxerr,maxval)
+            for (int z = 0; z < (int)nslices; ++z)
+                for (int p = 0; p < GridMPI::NVAR; ++p)
+                {
+                    const Real * const in = src[p] + srcOFFSET + SLICE_GPU * z;
+                    for (uint_t k = 0; k < SLICE_GPU; ++k)
+                    {
+                        const Real rounded = static_cast<Real>(static_cast<TmpReal>(in[k]));
+                        maxerr = std::max(maxerr, std::abs(in[k] - rounded));
+                        maxval = std::max(maxval, std::abs(in[k]));
+                    }
+                }
+            tmp_maxerr = maxerr;
+            tmp_maxval = maxval;
+        }
+
         inline void _copy_xyghosts() // alternatively, copy ALL x/yghosts at beginning
         {
+            // streamed halos hold the current chunk only
+            const uint_t chunk = curr_iz / nslices;
+            const uint_t iz = halo_stream ? 0 : curr_iz;
+            if (halo_stream) _stream_wait(chunk);
+
             // copy from the halos into the ghost buffer of the current chunk
-            _copy_range(curr_buffer->xghost_l, 0, halox.left,  3*sizeY*curr_iz, curr_buffer->Nxghost);
-            _copy_range(curr_buffer->xghost_r, 0, halox.right, 3*sizeY*curr_iz, curr_buffer->Nxghost);
-            _copy_range(curr_buffer->yghost_l, 0, haloy.left,  3*sizeX*curr_iz, curr_buffer->Nyghost);
-            _copy_range(curr_buffer->yghost_r, 0, haloy.right, 3*sizeX*curr_iz, curr_buffer->Nyghost);
+            _copy_range(curr_buffer->xghost_l, 0, halox.left,  3*sizeY*iz, curr_buffer->Nxghost);
+            _copy_range(curr_buffer->xghost_r, 0, halox.right, 3*sizeY*iz, curr_buffer->Nxghost);
+            _copy_range(curr_buffer->yghost_l, 0, haloy.left,  3*sizeX*iz, curr_buffer->Nyghost);
+            _copy_range(curr_buffer->yghost_r, 0, haloy.right, 3*sizeX*iz, curr_buffer->Nyghost);
+
+            // the next chunk is still unmodified in the grid (its write-back
+            // happens while processing the chunk after it)
+            if (halo_stream && chunk + 1 < nchunks) _stream_post(chunk + 1);
         }
 
         // execution helper
         void _process_chunk_sos(const RealPtrVec_t& src);
-        void _process_chunk_flow(const Real a, const Real b, const Real dtinvh, RealPtrVec_t& src, RealPtrVec_t& tmp);
+        void _process_chunk_flow(const Real a, const Real b, const Real dtinvh, RealPtrVec_t& src, TmpPtrVec_t& tmp);
 
         // info
         void _print_array(const Real * const in, const uint_t size);
@@ -240,6 +446,9 @@ class GPUlab
 
         // ghosts
         Halo halox, haloy, haloz;
+        uint_t bc_iz, bc_nslices; // z-range of the x/y halos the BC's apply to
+
+        inline Halo& _face_halo(const int face) { return face < 2 ? halox : (face < 4 ? haloy : haloz); }
 
         // boundary conditions (applied for myFeature == SKIN)
         virtual void _apply_bc(const double t = 0) {}
@@ -248,11 +457,21 @@ class GPUlab
     public:
 
         GPUlab(GridMPI& G, const uint_t nslices, const int verbosity=0);
-        virtual ~GPUlab() { _free_GPU(); }
+        virtual ~GPUlab()
+        {
+            _free_halo_stream();
+            _free_halo_exchange();
+            _free_GPU();
+            HostMemory::release(HostMemory::HALOS, halo_bytes);
+            HostMemory::release(HostMemory::BUFFERS, buffer_bytes);
+        }
 
         ///////////////////////////////////////////////////////////////////////
         // PUBLIC ACCESSORS
         ///////////////////////////////////////////////////////////////////////
+        void set_halo_exchange(const std::string mode);
+        void set_halo_encoding(const std::string encoding);
+        void set_halo_stream(const bool stream);
         void load_ghosts(const double t = 0);
         double max_sos(float& sos);
         double process_all(const Real a, const Real b, const Real dtinvh);
@@ -262,4 +481,8 @@ class GPUlab
         inline uint_t chunk_slices() const { return curr_slices; }
         inline uint_t chunk_start_iz() const { return curr_iz; }
         inline uint_t chunk_id() const { return curr_chunk_id; }
+        inline bool halo_encoded() const { return HaloEncoder::NONE != halo_encoding; }
+        inline double halo_encoding_ratio() const { return halo_msgbytes > 0 ? (double)halo_rawbytes / halo_msgbytes : 1.0; }
+        inline bool tmp_reduced() const { return sizeof(TmpReal) < sizeof(Real); }
+        inline double tmp_rounding_error() const { return tmp_maxval > 0 ? (double)tmp_maxerr / tmp_maxval : 0.0; }
 };
@@ -10,6 +10,7 @@
 #pragma once
 
 #include <mpi.h>
+#include <stdio.h>
 #include <vector>
 #include <cmath>
 #include "NodeBlock.h"
@@ -22,9 +23,26 @@ using namespace std;
 #define _MPI_REAL_ MPI_DOUBLE
 #endif
 
+// Edge of the sub-blocks a rank block is decomposed into for the wavelet
+// serializer, which compresses them in parallel.  Defaults to _BLOCKSIZE_ if
+// defined, otherwise the rank block is one sub-block.
+#if !defined(_SUBBLOCKSIZE_) && defined(_BLOCKSIZE_)
+#define _SUBBLOCKSIZE_ _BLOCKSIZE_
+#endif
+
 
 class GridMPI : public NodeBlock
 {
+    public:
+
+    struct SubBlockInfo
+    {
+        int index[3];   // global sub-block index
+        int start[3];   // first cell in this rank block
+        int size[3];    // number of cells
+    };
+
+
     protected:
 
     int myrank, mypeindex[3], pesize[3];
@@ -36,6 +54,9 @@ class GridMPI : public NodeBlock
 
     MPI_Comm cart_world;
 
+    int subbpd[3]; // sub-blocks per dimension in this rank block
+    std::vector<SubBlockInfo> subblocks;
+
     void _get_nbr_ranks()
     {
         /* *
@@ -60,8 +81,190 @@ class GridMPI : public NodeBlock
     }
 
 
+    void _init_subblocks()
+    {
+        /* *
+         * Sub-blocks are views into the rank block (they share data/tmp),
+         * the time stepping keeps processing the rank block as a whole.
+         * */
+        int subsize[3];
+        for (int i = 0; i < 3; ++i)
+        {
+#ifdef _SUBBLOCKSIZE_
+            subsize[i] = _SUBBLOCKSIZE_;
+#else
+            subsize[i] = blocksize[i];
+#endif
+            if (blocksize[i] % subsize[i] != 0)
+            {
+                fprintf(stderr, "[GridMPI ERROR: Sub-block size %d does not divide block size %d\n", subsize[i], blocksize[i]);
+                exit(1);
+            }
+            subbpd[i] = blocksize[i] / subsize[i];
+        }
+
+        subblocks.resize(subbpd[0] * subbpd[1] * subbpd[2]);
+        for (int bz = 0; bz < subbpd[2]; ++bz)
+            for (int by = 0; by < subbpd[1]; ++by)
+                for (int bx = 0; bx < subbpd[0]; ++bx)
+                {
+                    const int b[3] = {bx, by, bz};
+                    SubBlockInfo& info = subblocks[bx + subbpd[0] * (by + subbpd[1] * bz)];
+                    for (int i = 0; i < 3; ++i)
+                    {
+                        info.index[i] = mypeindex[i] * subbpd[i] + b[i];
+                        info.start[i] = b[i] * subsize[i];
+                        info.size[i]  = subsize[i];
+                    }
+                }
+    }
+
+
+    static double _internode_surface(const int pe[3], const int node[3], const int bs[3])
+    {
+        // halo cells a node (node[0]*node[1]*node[2] ranks) exchanges with
+        // other nodes; faces of a dimension spanned by a node wrap around
+        // (periodic) within the node
+        double surface = 0;
+        for (int d = 0; d < 3; ++d)
+            if (pe[d] / node[d] > 1)
+                surface += 2.0 * (node[(d+1)%3]*bs[(d+1)%3]) * (node[(d+2)%3]*bs[(d+2)%3]);
+        return surface;
+    }
+
+    static double _domain_surface(const int pe[3], const int bs[3])
+    {
+        // surface of the global domain, minimal for the most cubic one
+        const double l[3] = {(double)pe[0]*bs[0], (double)pe[1]*bs[1], (double)pe[2]*bs[2]};
+        return l[0]*l[1] + l[1]*l[2] + l[2]*l[0];
+    }
+
+    void _auto_pesize(const int nranks, const int nodesize, int nodeshape[3])
+    {
+        if (!auto_pesize(nranks, nodesize, blocksize, pesize, nodeshape))
+        {
+            fprintf(stderr, "[GridMPI ERROR: No process grid with %d ranks matches the given dimensions\n", nranks);
+            exit(1);
+        }
+    }
+
+    void _create_auto_cart()
+    {
+        /* *
+         * Automatic process grid:  ranks on the same node (shared memory
+         * communicator) are assigned a compact sub-box of the process grid.
+         * Falls back to one rank per "node" if the node sizes differ.
+         * */
+        int world_size, world_rank;
+        MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+        MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+        MPI_Comm node_comm;
+        MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+        int nodesize, noderank;
+        MPI_Comm_size(node_comm, &nodesize);
+        MPI_Comm_rank(node_comm, &noderank);
+
+        int minsize, maxsize;
+        MPI_Allreduce(&nodesize, &minsize, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+        MPI_Allreduce(&nodesize, &maxsize, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+        int nodeid = world_rank;
+        if (minsize == maxsize)
+        {
+            MPI_Comm leaders;
+            MPI_Comm_split(MPI_COMM_WORLD, noderank == 0 ? 0 : MPI_UNDEFINED, world_rank, &leaders);
+            if (noderank == 0)
+            {
+                MPI_Comm_rank(leaders, &nodeid);
+                MPI_Comm_free(&leaders);
+            }
+            MPI_Bcast(&nodeid, 1, MPI_INT, 0, node_comm);
+        }
+        else
+        {
+            nodesize = 1;
+            noderank = 0;
+        }
+        MPI_Comm_free(&node_comm);
+
+        int nodeshape[3];
+        _auto_pesize(world_size, nodesize, nodeshape);
+
+        // coordinates: node sub-box + position within the node (x-fastest)
+        const int nodegrid[3] = {pesize[0]/nodeshape[0], pesize[1]/nodeshape[1], pesize[2]/nodeshape[2]};
+        const int gcoords[3] = {nodeid % nodegrid[0], (nodeid / nodegrid[0]) % nodegrid[1], nodeid / (nodegrid[0]*nodegrid[1])};
+        const int lcoords[3] = {noderank % nodeshape[0], (noderank / nodeshape[0]) % nodeshape[1], noderank / (nodeshape[0]*nodeshape[1])};
+        int coords[3];
+        for (int i = 0; i < 3; ++i)
+            coords[i] = gcoords[i]*nodeshape[i] + lcoords[i];
+
+        // rank order of MPI_Cart_create (row-major)
+        const int key = (coords[0]*pesize[1] + coords[1])*pesize[2] + coords[2];
+        MPI_Comm ordered;
+        MPI_Comm_split(MPI_COMM_WORLD, 0, key, &ordered);
+        MPI_Cart_create(ordered, 3, pesize, periodic, false, &cart_world);
+        MPI_Comm_free(&ordered);
+    }
+
+
     public:
 
+    /* *
+     * Factorize nranks into pesize (entries != 0 are kept) and nodesize
+     * into a node shape dividing pesize.  The block per rank is fixed, the
+     * process grid sets the shape of the global domain: the most compact
+     * (cubic) domain is chosen, with the halo surface between nodes as the
+     * secondary criterion and the most compact node sub-box as the last.
+     * Returns false if no process grid fits.
+     * */
+    static bool auto_pesize(const int nranks, const int nodesize, const int bs[3], int pesize[3], int nodeshape[3])
+    {
+        const int fixed[3] = {pesize[0], pesize[1], pesize[2]};
+        double bestdomain = -1, bestsurface = 0, bestnode = 0;
+        for (int px = 1; px <= nranks; ++px)
+        {
+            if (nranks % px || (fixed[0] && fixed[0] != px)) continue;
+            for (int py = 1; py <= nranks/px; ++py)
+            {
+                if ((nranks/px) % py || (fixed[1] && fixed[1] != py)) continue;
+                const int pz = nranks / (px*py);
+                if (fixed[2] && fixed[2] != pz) continue;
+                const int pe[3] = {px, py, pz};
+                const double domain = _domain_surface(pe, bs);
+                if (bestdomain >= 0 && domain > bestdomain) continue;
+
+                for (int nx = 1; nx <= nodesize; ++nx)
+                {
+                    if (nodesize % nx || px % nx) continue;
+                    for (int ny = 1; ny <= nodesize/nx; ++ny)
+                    {
+                        if ((nodesize/nx) % ny || py % ny) continue;
+                        const int nz = nodesize / (nx*ny);
+                        if (pz % nz) continue;
+                        const int node[3] = {nx, ny, nz};
+
+                        const double surface = _internode_surface(pe, node, bs);
+                        const double nodesurface = _domain_surface(node, bs);
+                        if (bestdomain < 0 || domain < bestdomain || surface < bestsurface ||
+                                (surface == bestsurface && nodesurface < bestnode))
+                        {
+                            bestdomain  = domain;
+                            bestsurface = surface;
+                            bestnode    = nodesurface;
+                            for (int i = 0; i < 3; ++i)
+                            {
+                                pesize[i] = pe[i];
+                                nodeshape[i] = node[i];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+        return bestdomain >= 0;
+    }
+
     GridMPI(const int npeX, const int npeY, const int npeZ, const double maxextent = 1):
         NodeBlock()
     {
@@ -75,17 +278,22 @@ class GridMPI : public NodeBlock
         periodic[1] = 1;
         periodic[2] = 1;
 
-        pesize[0] = npeX; // dimension of MPI cartesian topology
+        pesize[0] = npeX; // dimension of MPI cartesian topology (0 = automatic)
         pesize[1] = npeY;
         pesize[2] = npeZ;
 
-        h = maxextent / (std::max(pesize[0]*blocksize[0], std::max(pesize[1]*blocksize[1], pesize[2]*blocksize[2])));
+        if (npeX == 0 || npeY == 0 || npeZ == 0)
+            _create_auto_cart();
+        else
+        {
+            int world_size;
+            MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+            assert(npeX*npeY*npeZ == world_size);
 
-        int world_size;
-        MPI_Comm_size(MPI_COMM_WORLD, &world_size);
-        assert(npeX*npeY*npeZ == world_size);
+            MPI_Cart_create(MPI_COMM_WORLD, 3, pesize, periodic, true, &cart_world);
+        }
 
-        MPI_Cart_create(MPI_COMM_WORLD, 3, pesize, periodic, true, &cart_world);
+        h = maxextent / (std::max(pesize[0]*blocksize[0], std::max(pesize[1]*blocksize[1], pesize[2]*blocksize[2])));
 
         MPI_Comm_rank(cart_world, &myrank);
         MPI_Cart_coords(cart_world, myrank, 3, mypeindex);
@@ -103,6 +311,8 @@ class GridMPI : public NodeBlock
         gextent[0] = extent[0] * pesize[0];
         gextent[1] = extent[1] * pesize[1];
         gextent[2] = extent[2] * pesize[2];
+
+        _init_subblocks();
     }
 
     ~GridMPI() { }
@@ -114,6 +324,17 @@ class GridMPI : public NodeBlock
         return pesize[idim];
     }
 
+    inline int getResidentBlocksPerDimension(int idim) const
+    {
+        assert(idim>=0 && idim<3);
+        return subbpd[idim];
+    }
+
+    inline const std::vector<SubBlockInfo>& getBlocksInfo() const
+    {
+        return subblocks;
+    }
+
     inline void peindex(int mypeindex[3]) const
     {
         for(int i=0; i<3; ++i)
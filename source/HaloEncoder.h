@@ -0,0 +1,151 @@
+/* *
+ * HaloEncoder.h
+ *
+ * Encoding of halo messages: float down-conversion or lossless
+ * floating-point compression (FPC-like, last value predictor).
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+#include <stdint.h>
+#include <cstddef>
+
+#include "Types.h"
+
+#ifdef _FLOAT_PRECISION_
+typedef uint32_t RealBits_t;
+#else
+typedef uint64_t RealBits_t;
+#endif
+
+
+class HaloEncoder
+{
+    public:
+
+        enum Encoding {NONE=0, FLOAT, FPC};
+
+
+    private:
+
+        // FPC block of n values: 4-bit header per value (number of non-zero
+        // low order bytes of value XOR previous value), followed by the
+        // non-zero bytes
+        static size_t _encode_fpc(const Real * const src, const uint_t n, unsigned char * const dst)
+        {
+            unsigned char * const head = dst;
+            unsigned char *body = dst + (n+1)/2;
+            memset(head, 0, (n+1)/2);
+
+            RealBits_t pred = 0;
+            for (uint_t i = 0; i < n; ++i)
+            {
+                RealBits_t val;
+                memcpy(&val, src + i, sizeof(RealBits_t));
+                const RealBits_t x = val ^ pred;
+                pred = val;
+
+                int nb = sizeof(RealBits_t);
+                while (nb > 0 && !(x >> 8*(nb-1)))
+                    --nb;
+
+                head[i/2] |= nb << 4*(i&1);
+                for (int b = 0; b < nb; ++b)
+                    *body++ = (x >> 8*b) & 0xff;
+            }
+            return body - dst;
+        }
+
+        static void _decode_fpc(const unsigned char * const src, const uint_t n, Real * const dst)
+        {
+            const unsigned char * const head = src;
+            const unsigned char *body = src + (n+1)/2;
+
+            RealBits_t pred = 0;
+            for (uint_t i = 0; i < n; ++i)
+            {
+                const int nb = (head[i/2] >> 4*(i&1)) & 0xf;
+                RealBits_t x = 0;
+                for (int b = 0; b < nb; ++b)
+                    x |= static_cast<RealBits_t>(*body++) << 8*b;
+                pred ^= x;
+                memcpy(dst + i, &pred, sizeof(RealBits_t));
+            }
+        }
+
+        static inline size_t _bound_fpc(const uint_t n) { return (n+1)/2 + n*sizeof(Real); }
+
+
+    public:
+
+        static inline size_t bound(const uint_t Nhalo, const uint_t NVAR, const Encoding enc)
+        {
+            switch (enc)
+            {
+                case FLOAT: return NVAR*Nhalo*sizeof(float);
+                case FPC:   return NVAR*sizeof(uint32_t) + NVAR*_bound_fpc(Nhalo);
+                default:    return NVAR*Nhalo*sizeof(Real);
+            }
+        }
+
+        /* *
+         * Encode NVAR contiguous halos of size Nhalo in src into dst (at
+         * least bound() bytes).  Returns the number of encoded bytes.
+         * */
+        static size_t encode(const Real * const src, const uint_t Nhalo, const uint_t NVAR, unsigned char * const dst, const Encoding enc)
+        {
+            if (FLOAT == enc)
+            {
+                float * const out = (float *)dst;
+#pragma omp parallel for
+                for (int i = 0; i < (int)(NVAR*Nhalo); ++i)
+                    out[i] = static_cast<float>(src[i]);
+                return NVAR*Nhalo*sizeof(float);
+            }
+
+            assert(FPC == enc);
+            // variables are encoded in parallel into slots of the worst case
+            // size and compacted afterwards
+            uint32_t * const nbytes = (uint32_t *)dst;
+            unsigned char * const body = dst + NVAR*sizeof(uint32_t);
+            const size_t slot = _bound_fpc(Nhalo);
+#pragma omp parallel for
+            for (int p = 0; p < (int)NVAR; ++p)
+                nbytes[p] = _encode_fpc(src + p*Nhalo, Nhalo, body + p*slot);
+
+            size_t offset = nbytes[0];
+            for (uint_t p = 1; p < NVAR; ++p)
+            {
+                memmove(body + offset, body + p*slot, nbytes[p]);
+                offset += nbytes[p];
+            }
+            return NVAR*sizeof(uint32_t) + offset;
+        }
+
+        static void decode(const unsigned char * const src, const uint_t Nhalo, const uint_t NVAR, Real * const dst, const Encoding enc)
+        {
+            if (FLOAT == enc)
+            {
+                const float * const in = (const float *)src;
+#pragma omp parallel for
+                for (int i = 0; i < (int)(NVAR*Nhalo); ++i)
+                    dst[i] = static_cast<Real>(in[i]);
+                return;
+            }
+
+            assert(FPC == enc);
+            const uint32_t * const nbytes = (const uint32_t *)src;
+            const unsigned char * const body = src + NVAR*sizeof(uint32_t);
+            size_t offset[64];
+            assert(NVAR <= 64);
+            offset[0] = 0;
+            for (uint_t p = 1; p < NVAR; ++p)
+                offset[p] = offset[p-1] + nbytes[p-1];
+#pragma omp parallel for
+            for (int p = 0; p < (int)NVAR; ++p)
+                _decode_fpc(body + offset[p], Nhalo, dst + p*Nhalo);
+        }
+};
@@ -0,0 +1,115 @@
+/* *
+ * HostMemory.h
+ *
+ * Accounting of the major host allocations by category.  Keeps the current
+ * and peak bytes per rank, report() prints min/avg/max over ranks.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#pragma once
+
+#include <stdio.h>
+#include <cstddef>
+#include <algorithm>
+#include <sys/resource.h>
+#include <mpi.h>
+
+
+class HostMemory
+{
+    public:
+
+        enum Category {GRID=0, HALOS, BUFFERS, DUMP, COMPRESSION, NCATEGORIES};
+
+
+    private:
+
+        struct Ledger
+        {
+            size_t current[NCATEGORIES+1], peak[NCATEGORIES+1]; // last entry is the total
+        };
+
+        static Ledger& _ledger()
+        {
+            static Ledger book = {{0}, {0}};
+            return book;
+        }
+
+        static const char * _name(const int c)
+        {
+            static const char * const names[NCATEGORIES+1] = {"grid", "halos", "host buffers", "dump", "compression", "total"};
+            return names[c];
+        }
+
+
+    public:
+
+        static void allocate(const Category c, const size_t bytes)
+        {
+#pragma omp critical (hostmemory)
+            {
+                Ledger& book = _ledger();
+                book.current[c] += bytes;
+                book.current[NCATEGORIES] += bytes;
+                book.peak[c] = std::max(book.peak[c], book.current[c]);
+                book.peak[NCATEGORIES] = std::max(book.peak[NCATEGORIES], book.current[NCATEGORIES]);
+            }
+        }
+
+        static void release(const Category c, const size_t bytes)
+        {
+#pragma omp critical (hostmemory)
+            {
+                Ledger& book = _ledger();
+                book.current[c] -= std::min(bytes, book.current[c]);
+                book.current[NCATEGORIES] -= std::min(bytes, book.current[NCATEGORIES]);
+            }
+        }
+
+        // re-account an allocation which changed its size
+        static void resize(const Category c, size_t& accounted, const size_t bytes)
+        {
+            release(c, accounted);
+            allocate(c, bytes);
+            accounted = bytes;
+        }
+
+        static size_t current(const Category c) { return _ledger().current[c]; }
+        static size_t peak(const Category c) { return _ledger().peak[c]; }
+
+        /* *
+         * Collective over comm.  Prints current and peak MB per rank for
+         * each category (min/avg/max over ranks) on rank 0, and the peak
+         * resident set size of the process for untracked allocations.
+         * */
+        static void report(const char * const when, const MPI_Comm comm = MPI_COMM_WORLD)
+        {
+            const int N = 2*(NCATEGORIES+1) + 1;
+            const Ledger& book = _ledger();
+            double mine[N];
+            for (int c = 0; c <= NCATEGORIES; ++c)
+            {
+                mine[2*c+0] = book.current[c] / 1024. / 1024.;
+                mine[2*c+1] = book.peak[c] / 1024. / 1024.;
+            }
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            mine[N-1] = usage.ru_maxrss / 1024.; // kB on Linux
+
+            int rank, size;
+            MPI_Comm_rank(comm, &rank);
+            MPI_Comm_size(comm, &size);
+            double lo[N], hi[N], sum[N];
+            MPI_Reduce(mine, lo,  N, MPI_DOUBLE, MPI_MIN, 0, comm);
+            MPI_Reduce(mine, hi,  N, MPI_DOUBLE, MPI_MAX, 0, comm);
+            MPI_Reduce(mine, sum, N, MPI_DOUBLE, MPI_SUM, 0, comm);
+            if (rank) return;
+
+            printf("[HOST MEMORY %s (MB per rank, min/avg/max over %d ranks)]\n", when, size);
+            printf("\t%-12s  %-31s  %s\n", "", "current", "peak");
+            for (int c = 0; c <= NCATEGORIES; ++c)
+                printf("\t%-12s  %9.1f /%9.1f /%9.1f  %9.1f /%9.1f /%9.1f\n", _name(c),
+                        lo[2*c], sum[2*c]/size, hi[2*c], lo[2*c+1], sum[2*c+1]/size, hi[2*c+1]);
+            printf("\t%-12s  %-31s  %9.1f /%9.1f /%9.1f\n", "process RSS", "", lo[N-1], sum[N-1]/size, hi[N-1]);
+        }
+};
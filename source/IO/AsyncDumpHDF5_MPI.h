@@ -0,0 +1,144 @@
+/* *
+ * AsyncDumpHDF5_MPI.h
+ *
+ * Background HDF5 dumps: the streamed grid (the points and channels
+ * selected by the dump options) is copied into a reusable snapshot buffer,
+ * which an I/O thread writes on a duplicated communicator while the time
+ * stepping continues.  At most one dump is in flight, the
+ * next dump only waits if the previous one is still being written.
+ *
+ * Requires MPI_THREAD_MULTIPLE (main.cpp requests it with -asyncdump),
+ * otherwise dumps are written synchronously with DumpHDF5_MPI.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#pragma once
+
+#include <stdio.h>
+#include <pthread.h>
+#include <string>
+#include <mpi.h>
+
+#include "HDF5Dumper_MPI.h"
+#include "HostMemory.h"
+#include "Timer.h"
+
+
+template<typename TGrid, typename Streamer>
+class AsyncDumpHDF5_MPI
+{
+    private:
+
+        TGrid& grid;
+        const HDF5DumpOptions opt;
+        const DumpLayout layout;
+        bool async;
+        MPI_Comm io_comm; // collective HDF5 calls of the I/O thread
+        Real *snapshot;
+        const size_t snapshot_bytes;
+
+        pthread_t io_thread;
+        bool inflight;
+        volatile bool written; // set by the I/O thread when done
+
+        // dump in flight
+        int iCounter;
+        std::string f_name, dump_path;
+        HDF5Series_MPI *series;
+
+        static void * _write(void * arg)
+        {
+            AsyncDumpHDF5_MPI * const self = static_cast<AsyncDumpHDF5_MPI *>(arg);
+            WriteHDF5_MPI<TGrid, Streamer>(self->grid, self->snapshot, self->layout, self->iCounter, self->f_name, self->dump_path, self->io_comm, self->opt, self->series);
+            self->written = true;
+            return NULL;
+        }
+
+
+    public:
+
+        AsyncDumpHDF5_MPI(TGrid& G, const HDF5DumpOptions& opt_ = HDF5DumpOptions()) :
+            grid(G), opt(opt_), layout(_dump_layout<TGrid, Streamer>(G, opt_)), async(false), io_comm(MPI_COMM_NULL), snapshot(NULL),
+            snapshot_bytes(sizeof(Real) * layout.points(layout.count[2]) * layout.nchannels()),
+            inflight(false), written(true), iCounter(0), series(NULL)
+        {
+            int provided, rank;
+            MPI_Query_thread(&provided);
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+            if (provided != MPI_THREAD_MULTIPLE)
+            {
+                if (rank == 0) fprintf(stderr, "[AsyncDumpHDF5_MPI WARNING: MPI_THREAD_MULTIPLE not available, dumps are written synchronously]\n");
+                return;
+            }
+
+            async = true;
+            MPI_Comm_dup(MPI_COMM_WORLD, &io_comm);
+            snapshot = new Real[std::max((size_t)1, snapshot_bytes / sizeof(Real))];
+            HostMemory::allocate(HostMemory::DUMP, snapshot_bytes);
+        }
+
+        ~AsyncDumpHDF5_MPI()
+        {
+            wait();
+            if (!async) return;
+
+            delete [] snapshot;
+            HostMemory::release(HostMemory::DUMP, snapshot_bytes);
+            MPI_Comm_free(&io_comm);
+        }
+
+        // wait for the dump in flight, returns the time spent waiting
+        double wait()
+        {
+            if (!inflight) return 0;
+
+            Timer timer;
+            timer.start();
+            pthread_join(io_thread, NULL);
+            inflight = false;
+            return timer.stop();
+        }
+
+        // collective, true if no rank has a dump in flight any more (it is
+        // then joined), never blocks on the I/O thread
+        bool test()
+        {
+            int done = !inflight || written;
+            MPI_Allreduce(MPI_IN_PLACE, &done, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+            if (done) wait();
+            return done;
+        }
+
+        // collective, returns the time spent waiting for the previous dump.
+        // A series must be opened on comm().
+        double dump(const int counter, const std::string name, const std::string path=".", HDF5Series_MPI * const series_=NULL)
+        {
+            if (!async)
+            {
+                DumpHDF5_MPI<TGrid, Streamer>(grid, counter, name, path, opt, series_);
+                return 0;
+            }
+
+            const double waited = wait();
+
+            StreamHDF5<TGrid, Streamer>(grid, snapshot, layout, 0, layout.count[2]);
+            iCounter  = counter;
+            f_name    = name;
+            dump_path = path;
+            series    = series_;
+
+            written = false;
+            if (pthread_create(&io_thread, NULL, _write, this) != 0)
+            {
+                fprintf(stderr, "[AsyncDumpHDF5_MPI WARNING: Can not create I/O thread, writing %s synchronously]\n", name.c_str());
+                _write(this);
+                return waited;
+            }
+            inflight = true;
+            return waited;
+        }
+
+        inline bool asynchronous() const { return async; }
+        // communicator of the dumps
+        inline MPI_Comm comm() const { return async ? io_comm : MPI_COMM_WORLD; }
+};
@@ -0,0 +1,385 @@
+/* *
+ * Checkpoint_MPI.h
+ *
+ * Binary restart files written with MPI-IO.  The state of every rank is
+ * written as it is stored in memory (the NVAR variables of pdata(), in the
+ * storage layout of the build), no transposition and no staging buffer:
+ *
+ *   [header, 512 bytes][table, 16 bytes per rank][pad][rank 0][rank 1]...
+ *
+ * The header holds t, step, fcount and what is needed to check that the
+ * file fits the running configuration.  The table holds, in rank order of
+ * the communicator, the linear process index and a checksum of the data of
+ * that rank.  Restart verifies the checksum of what it has read, in memory.
+ * A file is written to <name>.tmp and renamed when complete, an existing
+ * checkpoint is never left half-overwritten.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+
+#include "NodeBlock.h"
+
+
+struct CheckpointInfo
+{
+    double t;
+    unsigned int step, fcount;
+
+    CheckpointInfo(const double t_=0, const unsigned int step_=0, const unsigned int fcount_=0) :
+        t(t_), step(step_), fcount(fcount_) { }
+};
+
+
+struct CheckpointHeader
+{
+    char magic[8];
+    double t;
+    unsigned int step, fcount;
+    int nranks, pesize[3], blocksize[3], nvar, realsize, layout, layoutparam;
+    uint64_t rankbytes, data_offset;
+};
+
+static const char _CHECKPOINT_MAGIC_[8] = {'C','U','B','C','K','P','T','2'};
+static const int _CHECKPOINT_HEADER_BYTES_ = 512;
+static const int _CHECKPOINT_ALIGN_ = 4096;
+
+// storage layout of the build and its parameter (brick edge, AoSoA width),
+// raw data is only valid for the same layout
+#if defined(_USE_BRICKS_)
+static const int _CHECKPOINT_LAYOUT_ = 1;
+static const int _CHECKPOINT_LAYOUTPARAM_ = _BRICKSIZE_;
+#elif defined(_USE_AOSOA_)
+static const int _CHECKPOINT_LAYOUT_ = 2;
+static const int _CHECKPOINT_LAYOUTPARAM_ = _AOSOA_WIDTH_;
+#else
+static const int _CHECKPOINT_LAYOUT_ = 0;
+static const int _CHECKPOINT_LAYOUTPARAM_ = 0;
+#endif
+
+
+struct CheckpointSegment
+{
+    char *ptr;
+    size_t bytes;
+};
+
+/* *
+ * Memory segments of the state of grid, in file order.  A slab without
+ * padding (or the interleaved AoSoA slab) is a single segment, otherwise
+ * there is one segment per variable.
+ * */
+template<typename TGrid>
+static std::vector<CheckpointSegment> _checkpoint_segments(TGrid& grid)
+{
+    const size_t N = TGrid::sizeX * TGrid::sizeY * TGrid::sizeZ;
+    std::vector<CheckpointSegment> seg;
+    if (grid.pdata_slab() && grid.stride_slab() <= N)
+    {
+        CheckpointSegment s = {(char *)grid.pdata_slab(), sizeof(Real) * TGrid::NVAR * N};
+        seg.push_back(s);
+    }
+    else
+    {
+        const std::vector<Real *>& data = grid.pdata();
+        for (int var = 0; var < TGrid::NVAR; ++var)
+        {
+            CheckpointSegment s = {(char *)data[var], sizeof(Real) * N};
+            seg.push_back(s);
+        }
+    }
+    return seg;
+}
+
+/* *
+ * Checksum of the concatenated segments.  Fletcher-64 over 32-bit words of
+ * fixed 1 MB chunks (computed in parallel), the chunk sums are combined
+ * with FNV-1a.  The result only depends on the byte stream.
+ * */
+static uint64_t _checkpoint_checksum(const std::vector<CheckpointSegment>& seg)
+{
+    static const size_t CHUNK = 1 << 20;
+    size_t total = 0;
+    for (size_t s = 0; s < seg.size(); ++s)
+        total += seg[s].bytes;
+    const int nchunks = (total + CHUNK - 1) / CHUNK;
+    std::vector<uint64_t> sums(nchunks);
+
+#pragma omp parallel for schedule(static)
+    for (int c = 0; c < nchunks; ++c)
+    {
+        // locate the chunk in the segments, it may span several
+        size_t skip = c * CHUNK, left = std::min(CHUNK, total - c * CHUNK);
+        size_t s = 0;
+        while (skip >= seg[s].bytes) skip -= seg[s++].bytes;
+
+        uint64_t sum1 = 0, sum2 = 0;
+        size_t n = 0;
+        while (left > 0)
+        {
+            const size_t len = std::min(left, seg[s].bytes - skip);
+            const char *p = seg[s].ptr + skip;
+            for (size_t i = 0; i < len; i += 4)
+            {
+                uint32_t w = 0;
+                memcpy(&w, p + i, std::min((size_t)4, len - i));
+                sum1 += w;
+                sum2 += sum1;
+                // defer the reduction as long as sum2 cannot overflow
+                if (++n == 65536)
+                {
+                    sum1 %= 0xffffffffULL;
+                    sum2 %= 0xffffffffULL;
+                    n = 0;
+                }
+            }
+            left -= len;
+            skip = 0;
+            ++s;
+        }
+        sums[c] = ((sum2 % 0xffffffffULL) << 32) | (sum1 % 0xffffffffULL);
+    }
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (int c = 0; c < nchunks; ++c)
+    {
+        hash ^= sums[c];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// memory datatype covering the segments, used with MPI_BOTTOM.  Segments are
+// split into blocks of at most 1 GB, the block lengths are int.
+static MPI_Datatype _checkpoint_datatype(const std::vector<CheckpointSegment>& seg)
+{
+    static const size_t BLOCK = 1 << 30;
+    std::vector<int> len;
+    std::vector<MPI_Aint> disp;
+    for (size_t s = 0; s < seg.size(); ++s)
+        for (size_t o = 0; o < seg[s].bytes; o += BLOCK)
+        {
+            MPI_Aint addr;
+            MPI_Get_address(seg[s].ptr + o, &addr);
+            len.push_back(std::min(BLOCK, seg[s].bytes - o));
+            disp.push_back(addr);
+        }
+    MPI_Datatype mtype;
+    MPI_Type_create_hindexed(len.size(), &len[0], &disp[0], MPI_BYTE, &mtype);
+    MPI_Type_commit(&mtype);
+    return mtype;
+}
+
+template<typename TGrid>
+static int _checkpoint_peindex(TGrid& grid)
+{
+    int peidx[3];
+    grid.peindex(peidx);
+    return peidx[0] + grid.getBlocksPerDimension(0) * (peidx[1] + grid.getBlocksPerDimension(1) * peidx[2]);
+}
+
+template<typename TGrid>
+static CheckpointHeader _checkpoint_header(TGrid& grid, const CheckpointInfo& info, const int nranks)
+{
+    CheckpointHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, _CHECKPOINT_MAGIC_, sizeof(h.magic));
+    h.t        = info.t;
+    h.step     = info.step;
+    h.fcount   = info.fcount;
+    h.nranks   = nranks;
+    for (int i = 0; i < 3; ++i)
+        h.pesize[i] = grid.getBlocksPerDimension(i);
+    h.blocksize[0] = TGrid::sizeX;
+    h.blocksize[1] = TGrid::sizeY;
+    h.blocksize[2] = TGrid::sizeZ;
+    h.nvar      = TGrid::NVAR;
+    h.realsize  = sizeof(Real);
+    h.layout    = _CHECKPOINT_LAYOUT_;
+    h.layoutparam = _CHECKPOINT_LAYOUTPARAM_;
+    h.rankbytes = sizeof(Real) * TGrid::NVAR * TGrid::sizeX * TGrid::sizeY * TGrid::sizeZ;
+    const uint64_t meta = _CHECKPOINT_HEADER_BYTES_ + 2 * sizeof(uint64_t) * nranks;
+    h.data_offset = (meta + _CHECKPOINT_ALIGN_ - 1) / _CHECKPOINT_ALIGN_ * _CHECKPOINT_ALIGN_;
+    return h;
+}
+
+
+/* *
+ * Collective over comm.  Writes the state seg of this rank (checksum
+ * precomputed), which need not be the grid storage, e.g. a snapshot of it.
+ * */
+template<typename TGrid>
+static void _write_checkpoint(TGrid& grid, const CheckpointInfo& info, const std::vector<CheckpointSegment>& seg, const uint64_t checksum, const std::string filename, const MPI_Comm comm)
+{
+    int rank, nranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nranks);
+
+    const CheckpointHeader header = _checkpoint_header(grid, info, nranks);
+
+    uint64_t entry[2] = {(uint64_t)_checkpoint_peindex(grid), checksum};
+    std::vector<uint64_t> table(rank == 0 ? 2 * nranks : 0);
+    MPI_Gather(entry, 2, MPI_UINT64_T, rank == 0 ? &table[0] : NULL, 2, MPI_UINT64_T, 0, comm);
+
+    const std::string tmpname = filename + ".tmp";
+    MPI_File fh;
+    if (MPI_SUCCESS != MPI_File_open(comm, (char *)tmpname.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh))
+    {
+        fprintf(stderr, "[WriteCheckpoint_MPI ERROR: Can not open %s\n", tmpname.c_str());
+        exit(1);
+    }
+    MPI_File_set_size(fh, header.data_offset + nranks * header.rankbytes);
+
+    if (rank == 0)
+    {
+        char head[_CHECKPOINT_HEADER_BYTES_];
+        memset(head, 0, sizeof(head));
+        memcpy(head, &header, sizeof(header));
+        MPI_File_write_at(fh, 0, head, sizeof(head), MPI_BYTE, MPI_STATUS_IGNORE);
+        MPI_File_write_at(fh, _CHECKPOINT_HEADER_BYTES_, &table[0], 2 * nranks, MPI_UINT64_T, MPI_STATUS_IGNORE);
+    }
+
+    MPI_Datatype mtype = _checkpoint_datatype(seg);
+    MPI_File_write_at_all(fh, header.data_offset + rank * header.rankbytes, MPI_BOTTOM, 1, mtype, MPI_STATUS_IGNORE);
+    MPI_Type_free(&mtype);
+    MPI_File_close(&fh);
+
+    MPI_Barrier(comm);
+    if (rank == 0 && 0 != rename(tmpname.c_str(), filename.c_str()))
+    {
+        fprintf(stderr, "[WriteCheckpoint_MPI ERROR: Can not rename %s\n", tmpname.c_str());
+        exit(1);
+    }
+    MPI_Barrier(comm);
+}
+
+
+/* *
+ * Collective over comm.  Writes the state of the ranks of comm to filename,
+ * in rank order of comm (MPI_COMM_SELF: a file with the state of this rank
+ * only).  Returns the checksum of the data of this rank.
+ * */
+template<typename TGrid>
+uint64_t WriteCheckpoint_MPI(TGrid& grid, const CheckpointInfo& info, const std::string filename, const MPI_Comm comm=MPI_COMM_WORLD)
+{
+    // the state is written straight from the grid
+    const std::vector<CheckpointSegment> seg = _checkpoint_segments(grid);
+    const uint64_t checksum = _checkpoint_checksum(seg);
+    _write_checkpoint(grid, info, seg, checksum, filename, comm);
+    return checksum;
+}
+
+
+/* *
+ * Collective over comm.  Reads only the header of filename, returns false if
+ * it is not a checkpoint.  Nothing is validated beyond that.
+ * */
+static bool ReadCheckpointInfo_MPI(const std::string filename, CheckpointInfo& info, const MPI_Comm comm=MPI_COMM_WORLD)
+{
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    if (rank == 0)
+    {
+        FILE *f = fopen(filename.c_str(), "rb");
+        if (f)
+        {
+            if (1 != fread(&header, sizeof(header), 1, f))
+                memset(&header, 0, sizeof(header));
+            fclose(f);
+        }
+    }
+    MPI_Bcast(&header, sizeof(header), MPI_BYTE, 0, comm);
+
+    if (0 != memcmp(header.magic, _CHECKPOINT_MAGIC_, sizeof(header.magic)))
+        return false;
+    info.t      = header.t;
+    info.step   = header.step;
+    info.fcount = header.fcount;
+    return true;
+}
+
+
+/* *
+ * Collective over comm.  Reads the state of this rank from filename: the
+ * entry with the process index of this rank (the same rank of comm if the
+ * file was written by comm).  Returns true on all ranks if the file matches
+ * the configuration and all checksums agree, info is then set.
+ * */
+template<typename TGrid>
+bool ReadCheckpoint_MPI(TGrid& grid, CheckpointInfo& info, const std::string filename, const MPI_Comm comm=MPI_COMM_WORLD, const bool verbose=true)
+{
+    int rank, nranks;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &nranks);
+
+    MPI_File fh;
+    int ok = MPI_SUCCESS == MPI_File_open(comm, (char *)filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+    if (!ok)
+    {
+        if (verbose && rank == 0) fprintf(stderr, "[ReadCheckpoint_MPI: Can not open %s\n", filename.c_str());
+        return false;
+    }
+
+    // header and table of the file
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    if (rank == 0)
+        MPI_File_read_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    MPI_Bcast(&header, sizeof(header), MPI_BYTE, 0, comm);
+
+    const CheckpointHeader expect = _checkpoint_header(grid, info, header.nranks);
+    ok = 0 == memcmp(header.magic, expect.magic, sizeof(header.magic)) &&
+        header.nranks > 0 && header.nranks <= expect.pesize[0] * expect.pesize[1] * expect.pesize[2] &&
+        0 == memcmp(header.pesize, expect.pesize, sizeof(header.pesize)) &&
+        0 == memcmp(header.blocksize, expect.blocksize, sizeof(header.blocksize)) &&
+        header.nvar == expect.nvar && header.realsize == expect.realsize &&
+        header.layout == expect.layout && header.layoutparam == expect.layoutparam && header.rankbytes == expect.rankbytes &&
+        header.data_offset == expect.data_offset;
+    if (!ok)
+    {
+        if (verbose && rank == 0) fprintf(stderr, "[ReadCheckpoint_MPI: %s does not match this configuration\n", filename.c_str());
+        MPI_File_close(&fh);
+        return false;
+    }
+
+    std::vector<uint64_t> table(2 * header.nranks);
+    if (rank == 0)
+        MPI_File_read_at(fh, _CHECKPOINT_HEADER_BYTES_, &table[0], table.size(), MPI_UINT64_T, MPI_STATUS_IGNORE);
+    MPI_Bcast(&table[0], table.size(), MPI_UINT64_T, 0, comm);
+
+    // entry of this rank, by process index
+    const uint64_t myidx = _checkpoint_peindex(grid);
+    int entry = (rank < header.nranks && table[2 * rank] == myidx) ? rank : -1;
+    for (int r = 0; r < header.nranks && entry < 0; ++r)
+        if (table[2 * r] == myidx) entry = r;
+
+    const std::vector<CheckpointSegment> seg = _checkpoint_segments(grid);
+    MPI_Datatype mtype = _checkpoint_datatype(seg);
+    MPI_File_read_at_all(fh, header.data_offset + std::max(entry, 0) * header.rankbytes, MPI_BOTTOM, entry < 0 ? 0 : 1, mtype, MPI_STATUS_IGNORE);
+    MPI_Type_free(&mtype);
+    MPI_File_close(&fh);
+
+    int mine = entry >= 0 && _checkpoint_checksum(seg) == table[2 * entry + 1];
+    MPI_Allreduce(&mine, &ok, 1, MPI_INT, MPI_LAND, comm);
+    if (!ok)
+    {
+        if (verbose && rank == 0) fprintf(stderr, "[ReadCheckpoint_MPI: %s is incomplete or corrupt\n", filename.c_str());
+        return false;
+    }
+
+    info.t      = header.t;
+    info.step   = header.step;
+    info.fcount = header.fcount;
+    return true;
+}
@@ -13,6 +13,16 @@
 #include <cassert>
 #include <mpi.h>
 #include <iostream>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <cmath>
+#include <vector>
+#include <string>
+
+#include "HostMemory.h"
+#include "IOGroup_MPI.h"
 
 #ifdef _USE_HDF_
 #include <hdf5.h>
@@ -20,171 +30,815 @@
 
 #ifdef _FLOAT_PRECISION_
 #define HDF_REAL H5T_NATIVE_FLOAT
+#define _MPI_REAL_ MPI_FLOAT
 #else
 #define HDF_REAL H5T_NATIVE_DOUBLE
+#define _MPI_REAL_ MPI_DOUBLE
 #endif
 
 using namespace std;
 
 
-template<typename TGrid, typename Streamer >
-void DumpHDF5_MPI(TGrid &grid, const int iCounter, const string f_name, const string dump_path=".")
+/* *
+ * Options of DumpHDF5_MPI:
+ * nslab:    z-slices streamed and written per H5Dwrite (0: whole block)
+ * chunked:  chunked dataset, one chunk per rank and slab
+ * deflate:  gzip level (0: off), shuffle: byte shuffle before deflate
+ * zfp:      fixed-accuracy ZFP tolerance (0: off), needs the H5Z-ZFP plugin
+ * channels: streamer channels to write (empty: all)
+ * roi:      only points within the physical box [roi_start, roi_end)
+ * stride:   subsampling, every stride-th point of the global grid
+ * group:    two-phase writing, ranks per aggregator (1: every rank writes,
+ *           0: one aggregator per node), see IOGroup_MPI
+ * pieces:   file per process (per aggregator with group != 1), written
+ *           independently, the XDMF wrapper assembles the pieces
+ * Filters imply chunking.  Parallel writes of filtered datasets need HDF5
+ * 1.10.2 or newer.
+ * */
+struct HDF5DumpOptions
 {
-#ifdef _USE_HDF_
+    unsigned int nslab;
+    bool chunked, shuffle;
+    int deflate;
+    double zfp;
+    vector<int> channels;
+    bool roi;
+    double roi_start[3], roi_end[3];
+    unsigned int stride;
+    int group;
+    bool pieces;
+
+    HDF5DumpOptions() : nslab(0), chunked(false), shuffle(false), deflate(0), zfp(0), roi(false), stride(1), group(1), pieces(false)
+    {
+        for (int i = 0; i < 3; ++i)
+            roi_start[i] = roi_end[i] = 0;
+    }
 
-    int rank;
-    char filename[256];
-    herr_t status;
-    hid_t file_id, dataset_id, fspace_id, fapl_id, mspace_id;
+    inline bool filtered() const { return shuffle || deflate > 0 || zfp > 0; }
+    inline bool selective() const { return !channels.empty() || roi || stride > 1; }
+};
 
-    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+// streamer channels by name (Streamer::getChannelName) or index, comma
+// separated
+template<typename Streamer>
+vector<int> DumpChannels(const string list)
+{
+    vector<int> channels;
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        if (end == string::npos) end = list.size();
+        const string name = list.substr(pos, end - pos);
+        pos = end + 1;
+        if (name.empty()) continue;
+
+        int c = -1;
+        for (int i = 0; i < Streamer::NCHANNELS; ++i)
+            if (name == Streamer::getChannelName(i)) c = i;
+        if (c < 0 && name.find_first_not_of("0123456789") == string::npos)
+            c = atoi(name.c_str());
+        if (c < 0 || c >= Streamer::NCHANNELS)
+        {
+            fprintf(stderr, "[DumpHDF5_MPI ERROR: Unknown channel %s\n", name.c_str());
+            exit(1);
+        }
+        channels.push_back(c);
+    }
+    return channels;
+}
+
+
+/* *
+ * Points of a dump: the dataset extent and the part of this rank, which are
+ * the local grid points start + stride*i, i < count (x, y, z order).  With a
+ * region of interest, ranks outside of it have count 0.
+ * */
+struct DumpLayout
+{
+    unsigned int dims[3], offset[3], count[3];
+    unsigned int start[3], stride;
+    unsigned int block[3]; // nominal count of a rank
+    double origin[3];      // of the first dataset point
+    vector<int> channels;
+    bool selective;
+
+    inline unsigned int nchannels() const { return channels.size(); }
+    inline bool empty() const { return !count[0] || !count[1] || !count[2]; }
+    inline size_t points(const unsigned int nz) const { return (size_t)count[0] * count[1] * nz; }
+};
+
+
+template<typename TGrid, typename Streamer>
+DumpLayout _dump_layout(TGrid &grid, const HDF5DumpOptions& opt)
+{
+    DumpLayout layout;
+    layout.stride = std::max(1u, opt.stride);
+    layout.selective = opt.selective();
+    if (opt.channels.empty())
+        for (int i = 0; i < Streamer::NCHANNELS; ++i)
+            layout.channels.push_back(i);
+    else
+        layout.channels = opt.channels;
 
     int coords[3];
     grid.peindex(coords);
 
-    const unsigned int NX = TGrid::sizeX;
-    const unsigned int NY = TGrid::sizeY;
-    const unsigned int NZ = TGrid::sizeZ;
-    static const unsigned int NCHANNELS = Streamer::NCHANNELS;
+    const unsigned int N[3] = {TGrid::sizeX, TGrid::sizeY, TGrid::sizeZ};
+    const double h = grid.getH();
+    const unsigned int s = layout.stride;
+    for (int d = 0; d < 3; ++d)
+    {
+        // global index range [g0, g1) and its first point on the stride
+        const unsigned int G = grid.getBlocksPerDimension(d) * N[d];
+        unsigned int g0 = 0, g1 = G;
+        if (opt.roi)
+        {
+            g0 = std::min((double)G, std::max(0.0, std::floor(opt.roi_start[d] / h)));
+            g1 = std::min((double)G, std::max(0.0, std::ceil(opt.roi_end[d] / h)));
+            g1 = std::max(g0, g1);
+        }
+        const unsigned int first = (g0 + s - 1) / s * s;
+        layout.dims[d]   = g1 > first ? (g1 - first + s - 1) / s : 0;
+        layout.origin[d] = first * h;
+        layout.block[d]  = std::max(1u, std::min(layout.dims[d], (N[d] + s - 1) / s));
+
+        // intersection with this rank
+        const unsigned int lo = coords[d] * N[d];
+        const unsigned int a = std::max(std::max(lo, g0), first);
+        const unsigned int b = std::min(lo + N[d], g1);
+        const unsigned int lfirst = first + (a - first + s - 1) / s * s;
+        layout.count[d]  = b > lfirst ? (b - lfirst + s - 1) / s : 0;
+        layout.offset[d] = (lfirst - first) / s;
+        layout.start[d]  = lfirst - lo;
+    }
+    if (layout.empty())
+        layout.count[0] = layout.count[1] = layout.count[2] = 0;
 
-    if (rank==0)
-      {
-        cout << "Writing HDF5 file\n";
-        cout << "Allocating " << (NX * NY * NZ * NCHANNELS)/(1024.*1024.*1024.) << "GB of HDF5 data\n";
-      }
-    Real * array_all = new Real[NX * NY * NZ * NCHANNELS];
+    return layout;
+}
 
 
-    static const unsigned int sX = 0;
-    static const unsigned int sY = 0;
-    static const unsigned int sZ = 0;
+// transform the output slices [iz0, iz0+nz) of this rank into array (the
+// channels of the layout per point, x fastest)
+template<typename TGrid, typename Streamer>
+void StreamHDF5(TGrid &grid, Real * const array, const DumpLayout& layout, const unsigned int iz0, const unsigned int nz)
+{
+    const unsigned int NX = layout.count[0];
+    const unsigned int NY = layout.count[1];
+    const unsigned int NCHANNELS = layout.nchannels();
+    const int * const channels = NCHANNELS ? &layout.channels[0] : NULL;
+    const unsigned int s = layout.stride;
 
-    static const unsigned int eX = TGrid::sizeX;
-    static const unsigned int eY = TGrid::sizeY;
-    static const unsigned int eZ = TGrid::sizeZ;
+    assert(iz0 + nz <= layout.count[2]);
 
-    /* hsize_t count[4] = { */
-    /*     TGrid::sizeX, */
-    /*     TGrid::sizeY, */
-    /*     TGrid::sizeZ, NCHANNELS}; */
+    Streamer streamer(grid.pdata());
+#pragma omp parallel for
+    for(unsigned int iz=iz0; iz<iz0+nz; iz++)
+        for(unsigned int iy=0; iy<NY; iy++)
+            for(unsigned int ix=0; ix<NX; ix++)
+            {
+                const size_t idx = NCHANNELS * (ix + NX * (iy + (size_t)NY * (iz-iz0)));
+                assert(idx < layout.points(nz) * NCHANNELS);
 
-    /* hsize_t dims[4] = { */
-    /*     grid.getBlocksPerDimension(0)*TGrid::sizeX, */
-    /*     grid.getBlocksPerDimension(1)*TGrid::sizeY, */
-    /*     grid.getBlocksPerDimension(2)*TGrid::sizeZ, NCHANNELS}; */
+                Real * const ptr = array + idx;
 
-    /* hsize_t offset[4] = { */
-    /*     coords[0]*TGrid::sizeX, */
-    /*     coords[1]*TGrid::sizeY, */
-    /*     coords[2]*TGrid::sizeZ, 0}; */
+                Real output[Streamer::NCHANNELS];
+                for(int i=0; i<Streamer::NCHANNELS; ++i)
+                    output[i] = 0;
 
-    hsize_t count[4] = {
-        TGrid::sizeZ,
-        TGrid::sizeY,
-        TGrid::sizeX, NCHANNELS};
+                streamer.operate(layout.start[0] + s*ix, layout.start[1] + s*iy, layout.start[2] + s*iz, (Real *)output);
 
-    hsize_t dims[4] = {
-        grid.getBlocksPerDimension(2)*TGrid::sizeZ,
-        grid.getBlocksPerDimension(1)*TGrid::sizeY,
-        grid.getBlocksPerDimension(0)*TGrid::sizeX, NCHANNELS};
+                for(unsigned int i=0; i<NCHANNELS; ++i)
+                    ptr[i] = output[channels[i]];
+            }
+}
 
-    hsize_t offset[4] = {
-        coords[2]*TGrid::sizeZ,
-        coords[1]*TGrid::sizeY,
-        coords[0]*TGrid::sizeX, 0};
 
-    sprintf(filename, "%s/%s.h5", dump_path.c_str(), f_name.c_str());
+#ifdef _USE_HDF_
+// dataset of a dump in progress (collective over comm)
+struct HDF5Dump_MPI
+{
+    hid_t file_id, dataset_id, fspace_id, xfer_id;
+    hsize_t dims[4];    // z, y, x, channel
+    hsize_t offset[4];  // of this rank
+    hsize_t count[4];
+    bool external;      // file_id opened by the caller (series, pieces)
+};
+
+
+// H5Z-ZFP plugin (registered filter id), fixed-accuracy mode
+#define _H5Z_FILTER_ZFP_ 32013
+#define _H5Z_ZFP_MODE_ACCURACY_ 3
+
+// dataset creation properties for a rank block of count (z, y, x, channel)
+inline hid_t _createHDF5_dcpl(const hsize_t count[4], const HDF5DumpOptions& opt)
+{
+    const hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+    if (!opt.chunked && !opt.filtered()) return dcpl_id;
+
+    // chunks aligned with the rank blocks, and with the slabs such that every
+    // H5Dwrite covers whole chunks (partial chunks of filtered datasets would
+    // be read, modified and compressed again)
+    const hsize_t nslab = (opt.nslab == 0 || opt.nslab > count[0]) ? count[0] : opt.nslab;
+    const hsize_t chunk[4] = {count[0] % nslab ? count[0] : nslab, count[1], count[2], count[3]};
+    H5Pset_chunk(dcpl_id, 4, chunk);
+    H5Pset_fill_time(dcpl_id, H5D_FILL_TIME_NEVER);
+
+    if (opt.shuffle)
+        H5Pset_shuffle(dcpl_id);
+    if (opt.deflate > 0)
+        H5Pset_deflate(dcpl_id, opt.deflate);
+    if (opt.zfp > 0)
+    {
+        if (H5Zfilter_avail(_H5Z_FILTER_ZFP_) > 0)
+        {
+            // cd_values of H5Pset_zfp_accuracy_cdata(): mode, unused, double
+            unsigned int cd_values[4] = {_H5Z_ZFP_MODE_ACCURACY_, 0, 0, 0};
+            memcpy(&cd_values[2], &opt.zfp, sizeof(double));
+            H5Pset_filter(dcpl_id, _H5Z_FILTER_ZFP_, H5Z_FLAG_MANDATORY, 4, cd_values);
+        }
+        else
+        {
+            int rank;
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+            if (rank == 0) cout << "H5Z-ZFP filter not available (HDF5_PLUGIN_PATH), writing without ZFP\n";
+        }
+    }
+    return dcpl_id;
+}
 
+
+inline hid_t _openHDF5_MPI(const string filename, const MPI_Comm comm)
+{
     H5open();
-    fapl_id = H5Pcreate(H5P_FILE_ACCESS);
-    status = H5Pset_fapl_mpio(fapl_id, MPI_COMM_WORLD, MPI_INFO_NULL);
-    file_id = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id);
-    status = H5Pclose(fapl_id);
+    const hid_t fapl_id = H5Pcreate(H5P_FILE_ACCESS);
+    H5Pset_fapl_mpio(fapl_id, comm, MPI_INFO_NULL);
+    const hid_t file_id = H5Fcreate(filename.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id);
+    H5Pclose(fapl_id);
+    return file_id;
+}
 
 
-    Streamer streamer(grid.pdata());
-#pragma omp parallel for
-            /* for(unsigned int ix=sX; ix<eX; ix++) */
-        /* for(unsigned int iy=sY; iy<eY; iy++) */
-    /* for(unsigned int iz=sZ; iz<eZ; iz++) */
-    for(unsigned int iz=sZ; iz<eZ; iz++)
-        for(unsigned int iy=sY; iy<eY; iy++)
-            for(unsigned int ix=sX; ix<eX; ix++)
+// dataset name in file_id, or a new file filename with the dataset "data"
+// for file_id < 0 (opened on comm)
+inline void _createHDF5_MPI(HDF5Dump_MPI& dump, const DumpLayout& layout, const string filename, const MPI_Comm comm, const HDF5DumpOptions& opt, const hid_t file_id=-1, const string name="data")
+{
+    // dataset is z, y, x, channel
+    for (int i = 0; i < 3; ++i)
+    {
+        dump.dims[2-i]   = layout.dims[i];
+        dump.offset[2-i] = layout.offset[i];
+        dump.count[2-i]  = layout.count[i];
+    }
+    dump.dims[3]   = layout.nchannels();
+    dump.offset[3] = 0;
+    dump.count[3]  = layout.nchannels();
+
+    dump.external = file_id >= 0;
+    dump.file_id  = dump.external ? file_id : _openHDF5_MPI(filename, comm);
+
+    dump.xfer_id = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_dxpl_mpio(dump.xfer_id, H5FD_MPIO_COLLECTIVE);
+
+    const hsize_t block[4] = {layout.block[2], layout.block[1], layout.block[0], layout.nchannels()};
+    const bool nodata = !dump.dims[0] || !dump.dims[1] || !dump.dims[2] || !dump.dims[3];
+    const hid_t dcpl_id = nodata ? H5Pcreate(H5P_DATASET_CREATE) : _createHDF5_dcpl(block, opt);
+    const hid_t space_id = H5Screate_simple(4, dump.dims, NULL);
+    dump.dataset_id = H5Dcreate(dump.file_id, name.c_str(), HDF_REAL, space_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+    H5Sclose(space_id);
+    H5Pclose(dcpl_id);
+
+    dump.fspace_id = H5Dget_space(dump.dataset_id);
+}
+
+
+// collective: write the output slices [iz0, iz0+nz) of this rank (streamed
+// into array), nz = 0 for ranks without data in this round
+inline void _writeHDF5_MPI(HDF5Dump_MPI& dump, const Real * const array, const unsigned int iz0, const unsigned int nz)
+{
+    const hsize_t offset[4] = {dump.offset[0] + iz0, dump.offset[1], dump.offset[2], dump.offset[3]};
+    const hsize_t count[4]  = {nz, dump.count[1], dump.count[2], dump.count[3]};
+
+    hid_t mspace_id;
+    if (nz && count[1] && count[2] && count[3])
+    {
+        H5Sselect_hyperslab(dump.fspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
+        mspace_id = H5Screate_simple(4, count, NULL);
+    }
+    else
+    {
+        const hsize_t one[4] = {1, 1, 1, 1};
+        H5Sselect_none(dump.fspace_id);
+        mspace_id = H5Screate_simple(4, one, NULL);
+        H5Sselect_none(mspace_id);
+    }
+    H5Dwrite(dump.dataset_id, HDF_REAL, mspace_id, dump.fspace_id, dump.xfer_id, array);
+    H5Sclose(mspace_id);
+}
+
+
+inline void _closeHDF5_MPI(HDF5Dump_MPI& dump)
+{
+    H5Sclose(dump.fspace_id);
+    H5Dclose(dump.dataset_id);
+    H5Pclose(dump.xfer_id);
+    if (dump.external)
+        H5Fflush(dump.file_id, H5F_SCOPE_LOCAL);
+    else
+        H5Fclose(dump.file_id);
+    // no H5close(): files kept open across dumps (planes) stay valid, the
+    // library is closed at exit
+}
+
+
+/* *
+ * Two-phase writing of the slabs of a dump: the members of an I/O group send
+ * their slabs to the aggregator, which writes them one by one into the
+ * dataset (created on io.writer_comm).  Every aggregator issues the same
+ * number of collective writes per slab.  With groups of one rank, the slab
+ * is written directly.
+ *
+ * With pieces, every aggregator writes its own file <base>.<rank>.h5 with a
+ * dataset data_<rank> per member, independently of all other groups.
+ * */
+class HDF5Aggregate_MPI
+{
+    private:
+
+        const IOGroup_MPI& io;
+        const unsigned int NCHANNELS;
+        const bool pieces;
+        vector<unsigned int> members; // rank, offset[3], count[3] per member, on the aggregator
+        int nwrites;                  // per slab, max group size over aggregators
+        Real *gathered;
+        size_t gathered_bytes;
+
+        hid_t piece_file;
+        vector<HDF5Dump_MPI> piece;
+
+        inline unsigned int _nz(const int m, const unsigned int iz0, const unsigned int nslab) const
+        {
+            const unsigned int NZ = members[7*m+6];
+            return iz0 < NZ ? std::min(nslab, NZ - iz0) : 0;
+        }
+
+        inline size_t _points(const int m, const unsigned int nz) const
+        {
+            return (size_t)members[7*m+4] * members[7*m+5] * nz;
+        }
+
+        inline bool _empty(const int m) const { return !_points(m, members[7*m+6]); }
+
+        void _write(HDF5Dump_MPI& dump, const int m, const Real * const array, const unsigned int iz0, const unsigned int nz)
+        {
+            if (pieces)
+            {
+                if (nz && !_empty(m)) _writeHDF5_MPI(piece[m], array, iz0, nz);
+                return;
+            }
+            for (int i = 0; i < 3; ++i)
+            {
+                dump.offset[2-i] = members[7*m+1+i];
+                dump.count[2-i]  = members[7*m+4+i];
+            }
+            _writeHDF5_MPI(dump, array, iz0, nz);
+        }
+
+    public:
+
+        // collective over the communicator of io (over the group for pieces)
+        HDF5Aggregate_MPI(const IOGroup_MPI& io_, const DumpLayout& layout, const unsigned int nslab, const bool pieces_=false) :
+            io(io_), NCHANNELS(layout.nchannels()), pieces(pieces_), nwrites(io_.group_size), gathered(NULL), gathered_bytes(0), piece_file(-1)
+        {
+            int rank;
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+            const unsigned int mine[7] = {(unsigned int)rank, layout.offset[0], layout.offset[1], layout.offset[2], layout.count[0], layout.count[1], layout.count[2]};
+            members.assign(mine, mine + 7);
+            if (io.group_size == 1) return;
+
+            if (io.group_rank == 0) members.resize(7 * io.group_size);
+            MPI_Gather(mine, 7, MPI_UNSIGNED, &members[0], 7, MPI_UNSIGNED, 0, io.group_comm);
+            if (!io.writer()) return;
+
+            if (!pieces) MPI_Allreduce(MPI_IN_PLACE, &nwrites, 1, MPI_INT, MPI_MAX, io.writer_comm);
+            for (int m = 0; m < io.group_size; ++m)
+                gathered_bytes += sizeof(Real) * _points(m, _nz(m, 0, nslab)) * NCHANNELS;
+            gathered = new Real[std::max((size_t)1, gathered_bytes / sizeof(Real))];
+            HostMemory::allocate(HostMemory::DUMP, gathered_bytes);
+        }
+
+        ~HDF5Aggregate_MPI()
+        {
+            if (!gathered) return;
+            delete [] gathered;
+            HostMemory::release(HostMemory::DUMP, gathered_bytes);
+        }
+
+        // aggregators: create the piece file base.<rank>.h5, with the dataset
+        // data_<rank> for each non-empty member (no file without data)
+        void open_pieces(const string base, const DumpLayout& layout, const HDF5DumpOptions& opt)
+        {
+            if (!io.writer()) return;
+            bool empty = true;
+            for (int m = 0; m < io.group_size; ++m)
+                empty = empty && _empty(m);
+            if (empty) return;
+
+            char filename[256];
+            sprintf(filename, "%s.%05d.h5", base.c_str(), members[0]);
+            H5open();
+            piece_file = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+
+            piece.resize(io.group_size);
+            for (int m = 0; m < io.group_size; ++m)
             {
-                /* const unsigned int idx = NCHANNELS * (iz + NZ * (iy + NY * ix)); */
-                const unsigned int idx = NCHANNELS * (ix + NX * (iy + NY * iz));
-                assert(idx < NX * NY * NZ * NCHANNELS);
+                if (_empty(m)) continue;
 
-                Real * const ptr = array_all + idx;
+                DumpLayout local = layout;
+                for (int i = 0; i < 3; ++i)
+                {
+                    local.dims[i] = local.count[i] = local.block[i] = members[7*m+4+i];
+                    local.offset[i] = 0;
+                }
+                char name[32];
+                sprintf(name, "data_%05d", members[7*m]);
+                _createHDF5_MPI(piece[m], local, filename, MPI_COMM_SELF, opt, piece_file, name);
 
-                Real output[NCHANNELS];
-                for(int i=0; i<NCHANNELS; ++i)
-                    output[i] = 0;
+                // independent file, no MPI-IO transfer
+                H5Pclose(piece[m].xfer_id);
+                piece[m].xfer_id = H5Pcreate(H5P_DATASET_XFER);
+            }
+        }
+
+        void close_pieces()
+        {
+            if (piece_file < 0) return;
+            for (int m = 0; m < io.group_size; ++m)
+                if (!_empty(m)) _closeHDF5_MPI(piece[m]);
+            H5Fclose(piece_file);
+            piece_file = -1;
+        }
+
+        // collective over the communicator of io (over the group for
+        // pieces): the slices [iz0, iz0+nz) of this rank, where nz is the
+        // slab size clipped to its count
+        void write(HDF5Dump_MPI& dump, const Real * const array, const unsigned int iz0, const unsigned int nz, const unsigned int nslab)
+        {
+            if (io.group_size == 1)
+            {
+                _write(dump, 0, array, iz0, nz);
+                for (int w = 1; w < nwrites; ++w)
+                    _writeHDF5_MPI(dump, array, iz0, 0);
+                return;
+            }
 
-                streamer.operate(ix, iy, iz, (Real *)output);
+            // a whole node can exceed the int counts of MPI_Gatherv, the
+            // group gather is chunked
+            vector<size_t> bytes, displs;
+            if (io.writer())
+            {
+                bytes.resize(io.group_size);
+                displs.resize(io.group_size);
+                for (size_t m = 0, pos = 0; m < (size_t)io.group_size; ++m)
+                {
+                    bytes[m]  = sizeof(Real) * _points(m, _nz(m, iz0, nslab)) * NCHANNELS;
+                    displs[m] = pos;
+                    pos += bytes[m] / sizeof(Real);
+                }
+            }
+            const size_t mybytes = sizeof(Real) * members[4] * members[5] * nz * NCHANNELS;
+            io.gather(array, mybytes, gathered, io.writer() ? &bytes[0] : NULL);
+            if (!io.writer()) return;
 
-                for(int i=0; i<NCHANNELS; ++i)
-                    ptr[i] = output[i];
+            for (int w = 0; w < nwrites; ++w)
+            {
+                if (w < io.group_size)
+                    _write(dump, w, gathered + displs[w], iz0, _nz(w, iz0, nslab));
+                else
+                    _writeHDF5_MPI(dump, gathered, iz0, 0);
             }
+        }
+};
 
-    fapl_id = H5Pcreate(H5P_DATASET_XFER);
-    H5Pset_dxpl_mpio(fapl_id, H5FD_MPIO_COLLECTIVE);
 
-    fspace_id = H5Screate_simple(4, dims, NULL);
-    dataset_id = H5Dcreate(file_id, "data", HDF_REAL, fspace_id, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+// uniform grid of one dump, the dataset is h5ref (file:/dataset)
+template<typename TGrid, typename Streamer>
+void _writeXMFGrid(FILE * const xmf, TGrid &grid, const DumpLayout& layout, const int iCounter, const string h5ref)
+{
+    const int dims[4] = {(int)layout.dims[2], (int)layout.dims[1], (int)layout.dims[0], (int)layout.nchannels()};
+    const double h = grid.getH() * layout.stride;
+
+    fprintf(xmf, "   <Grid GridType=\"Uniform\">\n");
+    fprintf(xmf, "     <Time Value=\"%05d\"/>\n", iCounter);
+    fprintf(xmf, "     <Topology TopologyType=\"3DCORECTMesh\" Dimensions=\"%d %d %d\"/>\n", dims[0], dims[1], dims[2]);
+    fprintf(xmf, "     <Geometry GeometryType=\"ORIGIN_DXDYDZ\">\n");
+    fprintf(xmf, "       <DataItem Name=\"Origin\" Dimensions=\"3\" NumberType=\"Float\" Precision=\"4\" Format=\"XML\">\n");
+    fprintf(xmf, "        %e %e %e\n", layout.origin[2], layout.origin[1], layout.origin[0]);
+    fprintf(xmf, "       </DataItem>\n");
+    fprintf(xmf, "       <DataItem Name=\"Spacing\" Dimensions=\"3\" NumberType=\"Float\" Precision=\"4\" Format=\"XML\">\n");
+    fprintf(xmf, "        %e %e %e\n", h, h, h);
+    fprintf(xmf, "       </DataItem>\n");
+    fprintf(xmf, "     </Geometry>\n");
+
+    if (!layout.selective)
+    {
+        fprintf(xmf, "     <Attribute Name=\"data\" AttributeType=\"%s\" Center=\"Node\">\n", Streamer::getAttributeName());
+        fprintf(xmf, "       <DataItem Dimensions=\"%d %d %d %d\" NumberType=\"Float\" Precision=\"4\" Format=\"HDF\">\n", dims[0], dims[1], dims[2], dims[3]);
+        fprintf(xmf, "        %s\n", h5ref.c_str());
+        fprintf(xmf, "       </DataItem>\n");
+        fprintf(xmf, "     </Attribute>\n");
+    }
+    else
+    {
+        // one scalar per selected channel, a hyperslab of the dataset
+        for (int c = 0; c < dims[3]; ++c)
+        {
+            fprintf(xmf, "     <Attribute Name=\"%s\" AttributeType=\"Scalar\" Center=\"Node\">\n", Streamer::getChannelName(layout.channels[c]));
+            fprintf(xmf, "       <DataItem ItemType=\"HyperSlab\" Dimensions=\"%d %d %d 1\" Type=\"HyperSlab\">\n", dims[0], dims[1], dims[2]);
+            fprintf(xmf, "         <DataItem Dimensions=\"3 4\" Format=\"XML\">\n");
+            fprintf(xmf, "          0 0 0 %d\n", c);
+            fprintf(xmf, "          1 1 1 1\n");
+            fprintf(xmf, "          %d %d %d 1\n", dims[0], dims[1], dims[2]);
+            fprintf(xmf, "         </DataItem>\n");
+            fprintf(xmf, "         <DataItem Dimensions=\"%d %d %d %d\" NumberType=\"Float\" Precision=\"%d\" Format=\"HDF\">\n", dims[0], dims[1], dims[2], dims[3], (int)sizeof(Real));
+            fprintf(xmf, "          %s\n", h5ref.c_str());
+            fprintf(xmf, "         </DataItem>\n");
+            fprintf(xmf, "       </DataItem>\n");
+            fprintf(xmf, "     </Attribute>\n");
+        }
+    }
 
-    fspace_id = H5Dget_space(dataset_id);
-    H5Sselect_hyperslab(fspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
-    mspace_id = H5Screate_simple(4, count, NULL);
-    status = H5Dwrite(dataset_id, HDF_REAL, mspace_id, fspace_id, fapl_id, array_all);
+    fprintf(xmf, "   </Grid>\n");
+}
 
-    status = H5Sclose(mspace_id);
-    status = H5Sclose(fspace_id);
-    status = H5Dclose(dataset_id);
-    status = H5Pclose(fapl_id);
-    status = H5Fclose(file_id);
-    H5close();
 
-    delete [] array_all;
+template<typename TGrid, typename Streamer>
+void _writeXMF(TGrid &grid, const DumpLayout& layout, const int iCounter, const string f_name, const string dump_path)
+{
+    char wrapper[256];
+    sprintf(wrapper, "%s/%s.xmf", dump_path.c_str(), f_name.c_str());
+    FILE *xmf = 0;
+    xmf = fopen(wrapper, "w");
+    fprintf(xmf, "<?xml version=\"1.0\" ?>\n");
+    fprintf(xmf, "<!DOCTYPE Xdmf SYSTEM \"Xdmf.dtd\" []>\n");
+    fprintf(xmf, "<Xdmf Version=\"2.0\">\n");
+    fprintf(xmf, " <Domain>\n");
+    _writeXMFGrid<TGrid, Streamer>(xmf, grid, layout, iCounter, f_name + ".h5:/data");
+    fprintf(xmf, " </Domain>\n");
+    fprintf(xmf, "</Xdmf>\n");
+    fclose(xmf);
+}
+#endif
 
-    if (rank==0)
+
+/* *
+ * Time series of dumps in one HDF5 file kept open across the run: every dump
+ * adds the dataset /<f_name> (e.g. /data_0003) instead of a new file, and
+ * <basename>.xmf is a temporal collection of all dumps so far.  Saves the
+ * file create/open/close per dump on the metadata servers.  Collective over
+ * comm, which must be the communicator of the dumps written into it.
+ * */
+struct HDF5Series_MPI
+{
+    const string basename, dump_path;
+    const MPI_Comm comm;
+#ifdef _USE_HDF_
+    hid_t file_id;
+#endif
+
+    // dumps so far and end of the last grid in the XDMF collection (on the
+    // rank writing it)
+    int ndumps;
+    long xmf_end;
+
+    HDF5Series_MPI(const string basename_, const string dump_path_=".", const MPI_Comm comm_=MPI_COMM_WORLD) :
+        basename(basename_), dump_path(dump_path_), comm(comm_), ndumps(0), xmf_end(0)
+    {
+#ifdef _USE_HDF_
+        char filename[256];
+        sprintf(filename, "%s/%s.h5", dump_path.c_str(), basename.c_str());
+        file_id = _openHDF5_MPI(filename, comm);
+#endif
+    }
+
+    ~HDF5Series_MPI()
+    {
+#ifdef _USE_HDF_
+        H5Fclose(file_id);
+#endif
+    }
+};
+
+
+#ifdef _USE_HDF_
+template<typename TGrid, typename Streamer>
+void _writeSeriesXMF(TGrid &grid, HDF5Series_MPI& series, const DumpLayout& layout, const int iCounter, const string f_name)
+{
+    // appended in place: only the new grid and the closing tags are written,
+    // such that it is valid after every dump
+    char wrapper[256];
+    sprintf(wrapper, "%s/%s.xmf", series.dump_path.c_str(), series.basename.c_str());
+    FILE *xmf = fopen(wrapper, series.ndumps == 0 ? "w" : "r+");
+    if (!xmf)
+    {
+        fprintf(stderr, "[HDF5Series_MPI ERROR: Can not open %s\n", wrapper);
+        exit(1);
+    }
+    if (series.ndumps == 0)
     {
-        char wrapper[256];
-        sprintf(wrapper, "%s/%s.xmf", dump_path.c_str(), f_name.c_str());
-        FILE *xmf = 0;
-        xmf = fopen(wrapper, "w");
         fprintf(xmf, "<?xml version=\"1.0\" ?>\n");
         fprintf(xmf, "<!DOCTYPE Xdmf SYSTEM \"Xdmf.dtd\" []>\n");
         fprintf(xmf, "<Xdmf Version=\"2.0\">\n");
         fprintf(xmf, " <Domain>\n");
-        fprintf(xmf, "   <Grid GridType=\"Uniform\">\n");
-        fprintf(xmf, "     <Time Value=\"%05d\"/>\n", iCounter);
-        fprintf(xmf, "     <Topology TopologyType=\"3DCORECTMesh\" Dimensions=\"%d %d %d\"/>\n", (int)dims[0], (int)dims[1], (int)dims[2]);
-        fprintf(xmf, "     <Geometry GeometryType=\"ORIGIN_DXDYDZ\">\n");
-        fprintf(xmf, "       <DataItem Name=\"Origin\" Dimensions=\"3\" NumberType=\"Float\" Precision=\"4\" Format=\"XML\">\n");
-        fprintf(xmf, "        %e %e %e\n", 0.,0.,0.);
-        fprintf(xmf, "       </DataItem>\n");
-        fprintf(xmf, "       <DataItem Name=\"Spacing\" Dimensions=\"3\" NumberType=\"Float\" Precision=\"4\" Format=\"XML\">\n");
-        fprintf(xmf, "        %e %e %e\n", grid.getH(), grid.getH(), grid.getH());
-        fprintf(xmf, "       </DataItem>\n");
-        fprintf(xmf, "     </Geometry>\n");
+        fprintf(xmf, "  <Grid Name=\"%s\" GridType=\"Collection\" CollectionType=\"Temporal\">\n", series.basename.c_str());
+        series.xmf_end = ftell(xmf);
+    }
+    fseek(xmf, series.xmf_end, SEEK_SET);
+    _writeXMFGrid<TGrid, Streamer>(xmf, grid, layout, iCounter, series.basename + ".h5:/" + f_name);
+    series.xmf_end = ftell(xmf);
+    ++series.ndumps;
+
+    fprintf(xmf, "  </Grid>\n");
+    fprintf(xmf, " </Domain>\n");
+    fprintf(xmf, "</Xdmf>\n");
+    fclose(xmf);
+}
+#endif
 
-        fprintf(xmf, "     <Attribute Name=\"data\" AttributeType=\"%s\" Center=\"Node\">\n", Streamer::getAttributeName());
-        fprintf(xmf, "       <DataItem Dimensions=\"%d %d %d %d\" NumberType=\"Float\" Precision=\"4\" Format=\"HDF\">\n", (int)dims[0], (int)dims[1], (int)dims[2], (int)dims[3]);
-        fprintf(xmf, "        %s:/data\n",(f_name+".h5").c_str());
-        fprintf(xmf, "       </DataItem>\n");
-        fprintf(xmf, "     </Attribute>\n");
+#ifdef _USE_HDF_
+// collective over comm, rank 0 writes f_name.xmf: a spatial collection of the
+// blocks of all ranks, each the dataset data_<rank> in the piece file of its
+// aggregator (no halo points, with gaps of one cell between the blocks)
+template<typename TGrid, typename Streamer>
+void _writePiecesXMF(TGrid &grid, const IOGroup_MPI& io, const DumpLayout& layout, const int iCounter, const string f_name, const string dump_path, const MPI_Comm comm)
+{
+    int rank, writer, crank, csize;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_rank(comm, &crank);
+    MPI_Comm_size(comm, &csize);
+    writer = rank;
+    MPI_Bcast(&writer, 1, MPI_INT, 0, io.group_comm);
+
+    const unsigned int mine[8] = {(unsigned int)rank, (unsigned int)writer, layout.offset[0], layout.offset[1], layout.offset[2], layout.count[0], layout.count[1], layout.count[2]};
+    vector<unsigned int> all(crank == 0 ? 8 * csize : 8);
+    MPI_Gather(const_cast<unsigned int *>(mine), 8, MPI_UNSIGNED, &all[0], 8, MPI_UNSIGNED, 0, comm);
+    if (crank) return;
+
+    const double h = grid.getH() * layout.stride;
+
+    char wrapper[256];
+    sprintf(wrapper, "%s/%s.xmf", dump_path.c_str(), f_name.c_str());
+    FILE *xmf = 0;
+    xmf = fopen(wrapper, "w");
+    fprintf(xmf, "<?xml version=\"1.0\" ?>\n");
+    fprintf(xmf, "<!DOCTYPE Xdmf SYSTEM \"Xdmf.dtd\" []>\n");
+    fprintf(xmf, "<Xdmf Version=\"2.0\">\n");
+    fprintf(xmf, " <Domain>\n");
+    fprintf(xmf, "  <Grid Name=\"%s\" GridType=\"Collection\" CollectionType=\"Spatial\">\n", f_name.c_str());
+    for (int r = 0; r < csize; ++r)
+    {
+        const unsigned int * const p = &all[8*r];
+        if (!p[5] || !p[6] || !p[7]) continue;
+
+        DumpLayout piece = layout;
+        for (int i = 0; i < 3; ++i)
+        {
+            piece.dims[i]    = p[5+i];
+            piece.origin[i] += p[2+i] * h;
+        }
+        char h5ref[256];
+        sprintf(h5ref, "%s.%05d.h5:/data_%05d", f_name.c_str(), p[1], p[0]);
+        _writeXMFGrid<TGrid, Streamer>(xmf, grid, piece, iCounter, h5ref);
+    }
+    fprintf(xmf, "  </Grid>\n");
+    fprintf(xmf, " </Domain>\n");
+    fprintf(xmf, "</Xdmf>\n");
+    fclose(xmf);
+}
+#endif
 
-        fprintf(xmf, "   </Grid>\n");
-        fprintf(xmf, " </Domain>\n");
-        fprintf(xmf, "</Xdmf>\n");
-        fclose(xmf);
+// collective over comm (all ranks of the grid): write the streamed array
+// of each rank (layout.count[2] slices) into f_name.h5, or the dataset
+// f_name of series (opened on comm), rank 0 of comm writes the XDMF wrapper.
+// Only reads grid metadata, may run on an I/O thread.
+template<typename TGrid, typename Streamer>
+void WriteHDF5_MPI(TGrid &grid, const Real * const array, const DumpLayout& layout, const int iCounter, const string f_name, const string dump_path=".", const MPI_Comm comm=MPI_COMM_WORLD, const HDF5DumpOptions& opt=HDF5DumpOptions(), HDF5Series_MPI * const series=NULL)
+{
+#ifdef _USE_HDF_
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    char filename[256];
+    sprintf(filename, "%s/%s.h5", dump_path.c_str(), f_name.c_str());
+
+    // a series is opened on all ranks of comm, no aggregation or pieces
+    const bool pieces = opt.pieces && !series;
+    const IOGroup_MPI io(series ? 1 : opt.group, comm);
+    const unsigned int NZ = layout.count[2];
+    unsigned int maxNZ = NZ;
+    if (io.group_size > 1) MPI_Allreduce(MPI_IN_PLACE, &maxNZ, 1, MPI_UNSIGNED, MPI_MAX, io.group_comm);
+    HDF5Aggregate_MPI aggregate(io, layout, maxNZ, pieces);
+
+    HDF5Dump_MPI dump;
+    if (pieces)
+        aggregate.open_pieces(dump_path + "/" + f_name, layout, opt);
+    else if (io.writer())
+        _createHDF5_MPI(dump, layout, filename, io.writer_comm, opt, series ? series->file_id : -1, series ? f_name : "data");
+    aggregate.write(dump, array, 0, NZ, maxNZ);
+    if (pieces)
+        aggregate.close_pieces();
+    else if (io.writer())
+        _closeHDF5_MPI(dump);
+
+    if (pieces)
+        _writePiecesXMF<TGrid, Streamer>(grid, io, layout, iCounter, f_name, dump_path, comm);
+    else if (rank==0)
+    {
+        if (series) _writeSeriesXMF<TGrid, Streamer>(grid, *series, layout, iCounter, f_name);
+        else        _writeXMF<TGrid, Streamer>(grid, layout, iCounter, f_name, dump_path);
     }
 #else
 #warning USE OF HDF WAS DISABLED AT COMPILE TIME
 #endif
 }
 
+
+/* *
+ * The dataset is streamed and written in z-slabs of opt.nslab slices,
+ * through one buffer of nslab output slices.  All ranks write the same
+ * number of slabs (collective H5Dwrite), ranks outside of the region of
+ * interest with empty selections.  With a series, the dump is the dataset
+ * f_name of the series file.  With opt.group != 1, only the aggregators of
+ * the I/O groups write (two-phase, HDF5Aggregate_MPI).  With opt.pieces,
+ * every aggregator (rank) writes its own file, without collective I/O.
+ * */
+template<typename TGrid, typename Streamer >
+void DumpHDF5_MPI(TGrid &grid, const int iCounter, const string f_name, const string dump_path=".", const HDF5DumpOptions& opt=HDF5DumpOptions(), HDF5Series_MPI * const series=NULL)
+{
+#ifdef _USE_HDF_
+    const MPI_Comm comm = series ? series->comm : MPI_COMM_WORLD;
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+
+    const DumpLayout layout = _dump_layout<TGrid, Streamer>(grid, opt);
+    const unsigned int NZ = layout.count[2];
+    const unsigned int NCHANNELS = layout.nchannels();
+
+    // a series is opened on all ranks of comm, no aggregation or pieces
+    const bool pieces = opt.pieces && !series;
+    const IOGroup_MPI io(series ? 1 : opt.group, comm);
+
+    // pieces: the slab rounds are only synchronized within the group
+    unsigned int maxNZ = NZ;
+    MPI_Allreduce(MPI_IN_PLACE, &maxNZ, 1, MPI_UNSIGNED, MPI_MAX, pieces ? io.group_comm : comm);
+    const unsigned int nslab = (opt.nslab == 0 || opt.nslab > maxNZ) ? std::max(1u, maxNZ) : opt.nslab;
+
+    if (rank==0)
+      {
+        cout << "Writing HDF5 file\n";
+        cout << "Allocating " << (layout.points(std::min(nslab, NZ)) * NCHANNELS)/(1024.*1024.*1024.) << "GB of HDF5 data\n";
+      }
+    const size_t bytes = sizeof(Real) * layout.points(std::min(nslab, NZ)) * NCHANNELS;
+    Real * array_slab = new Real[bytes / sizeof(Real)];
+    HostMemory::allocate(HostMemory::DUMP, bytes);
+
+    char filename[256];
+    sprintf(filename, "%s/%s.h5", dump_path.c_str(), f_name.c_str());
+
+    HDF5Aggregate_MPI aggregate(io, layout, nslab, pieces);
+
+    HDF5Dump_MPI dump;
+    if (pieces)
+        aggregate.open_pieces(dump_path + "/" + f_name, layout, opt);
+    else if (io.writer())
+        _createHDF5_MPI(dump, layout, filename, io.writer_comm, opt, series ? series->file_id : -1, series ? f_name : "data");
+    for (unsigned int iz = 0; iz < maxNZ; iz += nslab)
+    {
+        const unsigned int nz = iz < NZ ? std::min(nslab, NZ - iz) : 0;
+        if (nz) StreamHDF5<TGrid, Streamer>(grid, array_slab, layout, iz, nz);
+        aggregate.write(dump, array_slab, iz, nz, nslab);
+    }
+    if (pieces)
+        aggregate.close_pieces();
+    else if (io.writer())
+        _closeHDF5_MPI(dump);
+
+    delete [] array_slab;
+    HostMemory::release(HostMemory::DUMP, bytes);
+
+    if (pieces)
+        _writePiecesXMF<TGrid, Streamer>(grid, io, layout, iCounter, f_name, dump_path, comm);
+    else if (rank==0)
+    {
+        if (series) _writeSeriesXMF<TGrid, Streamer>(grid, *series, layout, iCounter, f_name);
+        else        _writeXMF<TGrid, Streamer>(grid, layout, iCounter, f_name, dump_path);
+    }
+#endif
+}
+
+
 template<typename TGrid, typename Streamer>
 void ReadHDF5_MPI(TGrid &grid, const string f_name, const string dump_path=".")
 {
@@ -206,6 +860,7 @@ void ReadHDF5_MPI(TGrid &grid, const string f_name, const string dump_path=".")
     static const unsigned int NCHANNELS = Streamer::NCHANNELS;
 
     Real * array_all = new Real[NX * NY * NZ * NCHANNELS];
+    HostMemory::allocate(HostMemory::DUMP, sizeof(Real) * NX * NY * NZ * NCHANNELS);
 
     static const int sX = 0;
     static const int sY = 0;
@@ -265,9 +920,8 @@ void ReadHDF5_MPI(TGrid &grid, const string f_name, const string dump_path=".")
     status = H5Sclose(mspace_id);
     status = H5Fclose(file_id);
 
-    H5close();
-
     delete [] array_all;
+    HostMemory::release(HostMemory::DUMP, sizeof(Real) * NX * NY * NZ * NCHANNELS);
 #else
 #warning USE OF HDF WAS DISABLED AT COMPILE TIME
 #endif
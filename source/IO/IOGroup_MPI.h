@@ -0,0 +1,106 @@
+/* *
+ * IOGroup_MPI.h
+ *
+ * Aggregation groups for two-phase writing: the ranks of a communicator are
+ * grouped (consecutive ranks, or the ranks of a node), each group sends its
+ * data to an aggregator (rank 0 of the group) and only the aggregators
+ * access the file, with fewer and larger writes.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#pragma once
+
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+
+// transfers are split into chunks of at most 1 GB, MPI counts are int
+static const size_t _IOGROUP_CHUNK_ = (size_t)1 << 30;
+
+
+struct IOGroup_MPI
+{
+    MPI_Comm group_comm;  // ranks of the group, the aggregator is rank 0
+    MPI_Comm writer_comm; // aggregators, MPI_COMM_NULL on all other ranks
+    int group_rank, group_size;
+    bool owner;
+
+    /* *
+     * Collective over comm.  groupsize 1: every rank writes (group_comm is
+     * MPI_COMM_SELF, writer_comm is comm), groupsize > 1: groups of
+     * consecutive ranks, groupsize <= 0: one group per node.
+     * */
+    IOGroup_MPI(const int groupsize, const MPI_Comm comm=MPI_COMM_WORLD) : owner(groupsize != 1)
+    {
+        if (!owner)
+        {
+            group_comm  = MPI_COMM_SELF;
+            writer_comm = comm;
+            group_rank  = 0;
+            group_size  = 1;
+            return;
+        }
+
+        int rank;
+        MPI_Comm_rank(comm, &rank);
+        if (groupsize > 1)
+            MPI_Comm_split(comm, rank / groupsize, rank, &group_comm);
+        else
+            MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &group_comm);
+        MPI_Comm_rank(group_comm, &group_rank);
+        MPI_Comm_size(group_comm, &group_size);
+
+        MPI_Comm_split(comm, group_rank == 0 ? 0 : MPI_UNDEFINED, rank, &writer_comm);
+    }
+
+    ~IOGroup_MPI()
+    {
+        if (!owner) return;
+        MPI_Comm_free(&group_comm);
+        if (MPI_COMM_NULL != writer_comm) MPI_Comm_free(&writer_comm);
+    }
+
+    inline bool writer() const { return MPI_COMM_NULL != writer_comm; }
+
+    /* *
+     * Collective over the group: the aggregator receives bytes[m] bytes of
+     * member m into buf, in member order (its own are copied), bytes and
+     * buf are only used on the aggregator.
+     * */
+    void gather(const void * const mine, const size_t mybytes, void * const buf, const size_t * const bytes) const
+    {
+        const char * const send = static_cast<const char *>(mine);
+        std::vector<MPI_Request> req;
+        if (group_rank)
+        {
+            for (size_t o = 0; o < mybytes; o += _IOGROUP_CHUNK_)
+            {
+                req.push_back(MPI_REQUEST_NULL);
+                MPI_Isend(const_cast<char *>(send + o), (int)std::min(_IOGROUP_CHUNK_, mybytes - o), MPI_BYTE, 0, 0, group_comm, &req.back());
+            }
+        }
+        else
+        {
+            char * const recv = static_cast<char *>(buf);
+            memcpy(recv, send, mybytes);
+            size_t pos = mybytes;
+            for (int m = 1; m < group_size; pos += bytes[m++])
+                for (size_t o = 0; o < bytes[m]; o += _IOGROUP_CHUNK_)
+                {
+                    req.push_back(MPI_REQUEST_NULL);
+                    MPI_Irecv(recv + pos + o, (int)std::min(_IOGROUP_CHUNK_, bytes[m] - o), MPI_BYTE, m, 0, group_comm, &req.back());
+                }
+        }
+        if (!req.empty())
+            MPI_Waitall(req.size(), &req[0], MPI_STATUSES_IGNORE);
+    }
+
+    // independent write of any size at offset
+    static void write_at(MPI_File fh, const MPI_Offset offset, const void * const buf, const size_t bytes)
+    {
+        const char * const data = static_cast<const char *>(buf);
+        for (size_t o = 0; o < bytes; o += _IOGROUP_CHUNK_)
+            MPI_File_write_at(fh, offset + o, const_cast<char *>(data + o), (int)std::min(_IOGROUP_CHUNK_, bytes - o), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+};
@@ -0,0 +1,348 @@
+/* *
+ * MultiLevelCheckpoint_MPI.h
+ *
+ * Two-level checkpointing.  Every checkpoint is written to node-local
+ * storage (a file per rank in a local directory, e.g. /dev/shm), optionally
+ * mirrored to the local storage of a partner rank on another node.  Every
+ * Nth checkpoint is also flushed to the global file system: a snapshot of
+ * the state is written to the global checkpoint by an I/O thread on a
+ * duplicated communicator while the time stepping continues.  All files use
+ * the format of Checkpoint_MPI.h.
+ *
+ * Restart takes the newest consistent level: the local files if all ranks
+ * have a valid one (own or recovered from the partner's mirror) of the same
+ * step, otherwise the global checkpoint.
+ *
+ * The background flush requires MPI_THREAD_MULTIPLE (main.cpp requests it
+ * with -savelocal), otherwise the flush is synchronous.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <mpi.h>
+
+#include "Checkpoint_MPI.h"
+#include "HostMemory.h"
+#include "Timer.h"
+
+
+template<typename TGrid>
+class MultiLevelCheckpoint_MPI
+{
+    private:
+
+        TGrid& grid;
+        const std::string local_path, global_name;
+        const int global_every; // every Nth checkpoint is flushed
+        const bool mirror;
+        int rank, partner, mirrored; // partner holds my mirror, I hold the mirror of mirrored
+        int count;
+
+        bool async;
+        MPI_Comm io_comm; // collective MPI-IO of the I/O thread
+        char *snapshot;
+        const size_t snapshot_bytes;
+        pthread_t io_thread;
+        bool inflight;
+
+        // flush in flight
+        CheckpointInfo snapshot_info;
+        uint64_t snapshot_checksum;
+
+        std::string _local(const char * const kind, const int r) const
+        {
+            char name[256];
+            sprintf(name, "%s/%s_%05d.bin", local_path.c_str(), kind, r);
+            return std::string(name);
+        }
+
+        static void * _flush(void * arg)
+        {
+            MultiLevelCheckpoint_MPI * const self = static_cast<MultiLevelCheckpoint_MPI *>(arg);
+            // the snapshot holds the segments of the grid back to back
+            const std::vector<CheckpointSegment> gseg = _checkpoint_segments(self->grid);
+            std::vector<CheckpointSegment> seg(gseg);
+            char *p = self->snapshot;
+            for (size_t s = 0; s < seg.size(); p += seg[s++].bytes)
+                seg[s].ptr = p;
+            _write_checkpoint(self->grid, self->snapshot_info, seg, self->snapshot_checksum, self->global_name, self->io_comm);
+            return NULL;
+        }
+
+        // whole file, empty if it can not be read
+        static std::vector<char> _read_file(const std::string name)
+        {
+            std::vector<char> buf;
+            FILE *f = fopen(name.c_str(), "rb");
+            if (!f) return buf;
+            fseek(f, 0, SEEK_END);
+            buf.resize(ftell(f));
+            fseek(f, 0, SEEK_SET);
+            if (!buf.empty() && 1 != fread(&buf[0], buf.size(), 1, f))
+                buf.clear();
+            fclose(f);
+            return buf;
+        }
+
+        static void _write_file(const std::string name, const std::vector<char>& buf)
+        {
+            const std::string tmpname = name + ".tmp";
+            FILE *f = fopen(tmpname.c_str(), "wb");
+            if (!f || (!buf.empty() && 1 != fwrite(&buf[0], buf.size(), 1, f)) || 0 != fclose(f) || 0 != rename(tmpname.c_str(), name.c_str()))
+            {
+                fprintf(stderr, "[MultiLevelCheckpoint_MPI ERROR: Can not write %s\n", name.c_str());
+                exit(1);
+            }
+        }
+
+        // sends buf to dest and receives from source (any size, in chunks)
+        static std::vector<char> _exchange(const std::vector<char>& buf, const int dest, const int source)
+        {
+            uint64_t sendbytes = buf.size(), recvbytes = 0;
+            MPI_Sendrecv(&sendbytes, 1, MPI_UINT64_T, dest, 0, &recvbytes, 1, MPI_UINT64_T, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+            static const uint64_t CHUNK = 1 << 30;
+            std::vector<char> recv(recvbytes);
+            std::vector<MPI_Request> req;
+            for (uint64_t o = 0; o < recvbytes; o += CHUNK)
+            {
+                req.push_back(MPI_REQUEST_NULL);
+                MPI_Irecv(&recv[o], std::min(CHUNK, recvbytes - o), MPI_BYTE, source, 1, MPI_COMM_WORLD, &req.back());
+            }
+            for (uint64_t o = 0; o < sendbytes; o += CHUNK)
+            {
+                req.push_back(MPI_REQUEST_NULL);
+                MPI_Isend((void *)&buf[o], std::min(CHUNK, sendbytes - o), MPI_BYTE, dest, 1, MPI_COMM_WORLD, &req.back());
+            }
+            if (!req.empty())
+                MPI_Waitall(req.size(), &req[0], MPI_STATUSES_IGNORE);
+            return recv;
+        }
+
+        /* *
+         * Sends the checkpoint of this rank to partner (header and table,
+         * the state straight out of the grid) and writes the one received
+         * from mirrored to its mirror file, in the file format of a
+         * checkpoint written on MPI_COMM_SELF.  The received state passes
+         * through a buffer of at most CHUNK bytes.
+         * */
+        void _mirror(const CheckpointInfo& info, const uint64_t checksum)
+        {
+            static const size_t CHUNK = 1 << 26;
+
+            const CheckpointHeader header = _checkpoint_header(grid, info, 1);
+            std::vector<char> meta(header.data_offset, 0);
+            memcpy(&meta[0], &header, sizeof(header));
+            const uint64_t entry[2] = {(uint64_t)_checkpoint_peindex(grid), checksum};
+            memcpy(&meta[_CHECKPOINT_HEADER_BYTES_], entry, sizeof(entry));
+
+            std::vector<MPI_Request> req(1, MPI_REQUEST_NULL);
+            MPI_Isend(&meta[0], meta.size(), MPI_BYTE, partner, 3, MPI_COMM_WORLD, &req[0]);
+            const std::vector<CheckpointSegment> seg = _checkpoint_segments(grid);
+            for (size_t s = 0; s < seg.size(); ++s)
+                for (size_t o = 0; o < seg[s].bytes; o += CHUNK)
+                {
+                    req.push_back(MPI_REQUEST_NULL);
+                    MPI_Isend(seg[s].ptr + o, std::min(CHUNK, seg[s].bytes - o), MPI_BYTE, partner, 4, MPI_COMM_WORLD, &req.back());
+                }
+
+            const size_t bufbytes = std::max((size_t)header.data_offset, std::min(CHUNK, (size_t)header.rankbytes));
+            char * const buf = new char[bufbytes];
+            HostMemory::allocate(HostMemory::DUMP, bufbytes);
+
+            const std::string name = _local("mirror", mirrored);
+            const std::string tmpname = name + ".tmp";
+            FILE *f = fopen(tmpname.c_str(), "wb");
+            bool ok = NULL != f;
+
+            MPI_Recv(buf, header.data_offset, MPI_BYTE, mirrored, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            ok = ok && 1 == fwrite(buf, header.data_offset, 1, f);
+            // messages of the same sender arrive in order
+            for (uint64_t received = 0; received < header.rankbytes; )
+            {
+                MPI_Status status;
+                int bytes;
+                MPI_Probe(mirrored, 4, MPI_COMM_WORLD, &status);
+                MPI_Get_count(&status, MPI_BYTE, &bytes);
+                MPI_Recv(buf, bytes, MPI_BYTE, mirrored, 4, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+                ok = ok && 1 == fwrite(buf, bytes, 1, f);
+                received += bytes;
+            }
+            MPI_Waitall(req.size(), &req[0], MPI_STATUSES_IGNORE);
+
+            delete [] buf;
+            HostMemory::release(HostMemory::DUMP, bufbytes);
+
+            if (!ok || 0 != fclose(f) || 0 != rename(tmpname.c_str(), name.c_str()))
+            {
+                fprintf(stderr, "[MultiLevelCheckpoint_MPI ERROR: Can not write %s\n", name.c_str());
+                exit(1);
+            }
+        }
+
+        // the local checkpoint of this rank, recovered from the mirror of the
+        // partner if missing or corrupt
+        bool _read_local(CheckpointInfo& info)
+        {
+            bool ok = ReadCheckpoint_MPI(grid, info, _local("save", rank), MPI_COMM_SELF, false);
+            if (!mirror) return ok;
+
+            int need = !ok, theirs = 0;
+            MPI_Sendrecv(&need, 1, MPI_INT, partner, 2, &theirs, 1, MPI_INT, mirrored, 2, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            const std::vector<char> copy = _exchange(theirs ? _read_file(_local("mirror", mirrored)) : std::vector<char>(), mirrored, partner);
+            if (ok || copy.empty()) return ok;
+
+            _write_file(_local("save", rank), copy);
+            return ReadCheckpoint_MPI(grid, info, _local("save", rank), MPI_COMM_SELF, false);
+        }
+
+
+    public:
+
+        /* *
+         * Collective over MPI_COMM_WORLD.  Local files are written to
+         * local_dir, every global_every-th checkpoint to global_file.  With
+         * mirror_, the partner is the rank one node further (ranks are
+         * assumed to be placed node by node), or the next rank if all ranks
+         * share a node.
+         * */
+        MultiLevelCheckpoint_MPI(TGrid& G, const std::string local_dir, const std::string global_file, const int global_every_=10, const bool mirror_=false) :
+            grid(G), local_path(local_dir), global_name(global_file), global_every(std::max(1, global_every_)), mirror(mirror_),
+            count(0), async(false), io_comm(MPI_COMM_NULL), snapshot(NULL),
+            snapshot_bytes(sizeof(Real) * TGrid::NVAR * TGrid::sizeX * TGrid::sizeY * TGrid::sizeZ),
+            inflight(false), snapshot_checksum(0)
+        {
+            int size;
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+            MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+            // shift by the size of the first node, a rotation of the ranks
+            MPI_Comm node_comm;
+            int nodesize;
+            MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node_comm);
+            MPI_Comm_size(node_comm, &nodesize);
+            MPI_Comm_free(&node_comm);
+            MPI_Bcast(&nodesize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            const int shift = nodesize < size ? nodesize : 1;
+            partner  = (rank + shift) % size;
+            mirrored = (rank - shift + size) % size;
+            if (mirror && rank == 0 && shift == 1)
+                fprintf(stderr, "[MultiLevelCheckpoint_MPI WARNING: All ranks share a node, the mirror does not protect against its loss]\n");
+
+            int provided;
+            MPI_Query_thread(&provided);
+            if (provided != MPI_THREAD_MULTIPLE)
+            {
+                if (rank == 0) fprintf(stderr, "[MultiLevelCheckpoint_MPI WARNING: MPI_THREAD_MULTIPLE not available, global checkpoints are written synchronously]\n");
+                return;
+            }
+
+            async = true;
+            MPI_Comm_dup(MPI_COMM_WORLD, &io_comm);
+            snapshot = new char[snapshot_bytes];
+            HostMemory::allocate(HostMemory::DUMP, snapshot_bytes);
+        }
+
+        ~MultiLevelCheckpoint_MPI()
+        {
+            wait();
+            if (!async) return;
+
+            delete [] snapshot;
+            HostMemory::release(HostMemory::DUMP, snapshot_bytes);
+            MPI_Comm_free(&io_comm);
+        }
+
+        // wait for the flush in flight, returns the time spent waiting
+        double wait()
+        {
+            if (!inflight) return 0;
+
+            Timer timer;
+            timer.start();
+            pthread_join(io_thread, NULL);
+            inflight = false;
+            return timer.stop();
+        }
+
+        // collective, returns the time spent waiting for the previous flush
+        double save(const CheckpointInfo& info)
+        {
+            const uint64_t checksum = WriteCheckpoint_MPI(grid, info, _local("save", rank), MPI_COMM_SELF);
+
+            if (mirror)
+                _mirror(info, checksum);
+
+            if (++count % global_every != 0) return 0;
+
+            if (!async)
+            {
+                WriteCheckpoint_MPI(grid, info, global_name);
+                return 0;
+            }
+
+            const double waited = wait();
+
+            const std::vector<CheckpointSegment> seg = _checkpoint_segments(grid);
+            char *p = snapshot;
+            for (size_t s = 0; s < seg.size(); p += seg[s++].bytes)
+                memcpy(p, seg[s].ptr, seg[s].bytes);
+            snapshot_info     = info;
+            snapshot_checksum = checksum;
+
+            if (pthread_create(&io_thread, NULL, _flush, this) != 0)
+            {
+                fprintf(stderr, "[MultiLevelCheckpoint_MPI WARNING: Can not create I/O thread, writing %s synchronously]\n", global_name.c_str());
+                _flush(this);
+                return waited;
+            }
+            inflight = true;
+            return waited;
+        }
+
+        /* *
+         * Collective.  Loads the newest consistent checkpoint, returns false
+         * if there is none.
+         * */
+        bool restart(CheckpointInfo& info)
+        {
+            wait();
+
+            CheckpointInfo linfo;
+            int lok = _read_local(linfo);
+            unsigned int step[2] = {lok ? linfo.step : 0, lok ? linfo.step : 0};
+            MPI_Allreduce(MPI_IN_PLACE, &lok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, &step[0], 1, MPI_UNSIGNED, MPI_MIN, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, &step[1], 1, MPI_UNSIGNED, MPI_MAX, MPI_COMM_WORLD);
+            const bool local = lok && step[0] == step[1];
+
+            CheckpointInfo ginfo;
+            const bool global = ReadCheckpointInfo_MPI(global_name, ginfo);
+
+            if (local && (!global || linfo.step >= ginfo.step))
+            {
+                if (rank == 0) printf("Restarting from the local checkpoints\n");
+                info = linfo;
+                return true;
+            }
+            if (global && ReadCheckpoint_MPI(grid, info, global_name))
+            {
+                if (rank == 0) printf("Restarting from %s\n", global_name.c_str());
+                return true;
+            }
+            // the global checkpoint is corrupt, back to the local files
+            if (!local) return false;
+            int ok = ReadCheckpoint_MPI(grid, info, _local("save", rank), MPI_COMM_SELF, false);
+            MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+            return ok;
+        }
+
+        inline bool asynchronous() const { return async; }
+};
@@ -0,0 +1,288 @@
+/* *
+ * PlaneDumpHDF5_MPI.h
+ *
+ * High-frequency output of a 2D plane of the grid: the ranks intersecting
+ * the plane form a communicator and append the plane to one HDF5 file kept
+ * open across the run (dataset of dims time, z, y, x, channel with an
+ * unlimited time dimension, the extent along the plane normal is 1).  The
+ * XDMF wrapper is a temporal collection over all appended planes, extended
+ * in place by each append.  Planes can be sampled with defer() and written
+ * later with flush(), e.g. while HDF5 is busy with a background dump.  Ranks
+ * not intersecting the plane take no part in the output.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <mpi.h>
+
+#include "HDF5Dumper_MPI.h"
+#include "HostMemory.h"
+
+
+template<typename TGrid, typename Streamer>
+class PlaneDumpHDF5_MPI
+{
+    private:
+
+        TGrid& grid;
+        const int axis;
+        unsigned int index; // global grid index of the plane
+        DumpLayout layout;
+        MPI_Comm plane_comm; // MPI_COMM_NULL if not intersecting
+        size_t plane_bytes;
+
+        // planes sampled but not yet written (see defer()), buffers is a pool
+        // that grows to the longest backlog
+        std::vector<Real *> buffers;
+        std::vector<int> pending_steps;
+        std::vector<double> pending_times;
+
+        std::string f_name, dump_path;
+        std::vector<int> steps;
+        std::vector<double> times;
+        long xmf_end; // end of the last grid in the XDMF wrapper
+
+#ifdef _USE_HDF_
+        hid_t file_id, dataset_id, xfer_id;
+#endif
+
+        void _create(const HDF5DumpOptions& opt)
+        {
+#ifdef _USE_HDF_
+            char filename[256];
+            sprintf(filename, "%s/%s.h5", dump_path.c_str(), f_name.c_str());
+
+            H5open();
+            const hid_t fapl_id = H5Pcreate(H5P_FILE_ACCESS);
+            H5Pset_fapl_mpio(fapl_id, plane_comm, MPI_INFO_NULL);
+            file_id = H5Fcreate(filename, H5F_ACC_TRUNC, H5P_DEFAULT, fapl_id);
+            H5Pclose(fapl_id);
+
+            xfer_id = H5Pcreate(H5P_DATASET_XFER);
+            H5Pset_dxpl_mpio(xfer_id, H5FD_MPIO_COLLECTIVE);
+
+            // one chunk per rank and time, appended along time
+            const hsize_t dims[5]    = {0, layout.dims[2], layout.dims[1], layout.dims[0], layout.nchannels()};
+            const hsize_t maxdims[5] = {H5S_UNLIMITED, dims[1], dims[2], dims[3], dims[4]};
+            const hsize_t chunk[5]   = {1, layout.block[2], layout.block[1], layout.block[0], layout.nchannels()};
+            const hid_t dcpl_id = H5Pcreate(H5P_DATASET_CREATE);
+            H5Pset_chunk(dcpl_id, 5, chunk);
+            H5Pset_fill_time(dcpl_id, H5D_FILL_TIME_NEVER);
+            if (opt.shuffle)
+                H5Pset_shuffle(dcpl_id);
+            if (opt.deflate > 0)
+                H5Pset_deflate(dcpl_id, opt.deflate);
+
+            const hid_t space_id = H5Screate_simple(5, dims, maxdims);
+            dataset_id = H5Dcreate(file_id, "data", HDF_REAL, space_id, H5P_DEFAULT, dcpl_id, H5P_DEFAULT);
+            H5Sclose(space_id);
+            H5Pclose(dcpl_id);
+#endif
+        }
+
+        /* *
+         * Appends the last plane to the XDMF wrapper: only the new grid and
+         * the closing tags are written, the number of planes in the file
+         * (the extent of the time dimension) is the entity NT of the
+         * fixed-size header, which is rewritten in place.
+         * */
+        void _appendXMF()
+        {
+            const int dims[4] = {(int)layout.dims[2], (int)layout.dims[1], (int)layout.dims[0], (int)layout.nchannels()};
+            const int NT = steps.size();
+            const int n = NT - 1;
+            const double h = grid.getH();
+
+            char wrapper[256];
+            sprintf(wrapper, "%s/%s.xmf", dump_path.c_str(), f_name.c_str());
+            FILE *xmf = fopen(wrapper, NT == 1 ? "w" : "r+");
+            if (!xmf)
+            {
+                fprintf(stderr, "[PlaneDumpHDF5_MPI ERROR: Can not open %s\n", wrapper);
+                exit(1);
+            }
+            fprintf(xmf, "<?xml version=\"1.0\" ?>\n");
+            fprintf(xmf, "<!DOCTYPE Xdmf SYSTEM \"Xdmf.dtd\" [<!ENTITY NT \"%10d\">]>\n", NT);
+            if (NT == 1)
+            {
+                fprintf(xmf, "<Xdmf Version=\"2.0\">\n");
+                fprintf(xmf, " <Domain>\n");
+                fprintf(xmf, "   <Grid Name=\"%s\" GridType=\"Collection\" CollectionType=\"Temporal\">\n", f_name.c_str());
+                xmf_end = ftell(xmf);
+            }
+            fseek(xmf, xmf_end, SEEK_SET);
+
+            fprintf(xmf, "     <Grid Name=\"step %d\" GridType=\"Uniform\">\n", steps[n]);
+            fprintf(xmf, "       <Time Value=\"%e\"/>\n", times[n]);
+            fprintf(xmf, "       <Topology TopologyType=\"3DCORECTMesh\" Dimensions=\"%d %d %d\"/>\n", dims[0], dims[1], dims[2]);
+            fprintf(xmf, "       <Geometry GeometryType=\"ORIGIN_DXDYDZ\">\n");
+            fprintf(xmf, "         <DataItem Name=\"Origin\" Dimensions=\"3\" NumberType=\"Float\" Precision=\"4\" Format=\"XML\">\n");
+            fprintf(xmf, "          %e %e %e\n", layout.origin[2], layout.origin[1], layout.origin[0]);
+            fprintf(xmf, "         </DataItem>\n");
+            fprintf(xmf, "         <DataItem Name=\"Spacing\" Dimensions=\"3\" NumberType=\"Float\" Precision=\"4\" Format=\"XML\">\n");
+            fprintf(xmf, "          %e %e %e\n", h, h, h);
+            fprintf(xmf, "         </DataItem>\n");
+            fprintf(xmf, "       </Geometry>\n");
+            for (int c = 0; c < dims[3]; ++c)
+            {
+                fprintf(xmf, "       <Attribute Name=\"%s\" AttributeType=\"Scalar\" Center=\"Node\">\n", Streamer::getChannelName(layout.channels[c]));
+                fprintf(xmf, "         <DataItem ItemType=\"HyperSlab\" Dimensions=\"%d %d %d\" Type=\"HyperSlab\">\n", dims[0], dims[1], dims[2]);
+                fprintf(xmf, "           <DataItem Dimensions=\"3 5\" Format=\"XML\">\n");
+                fprintf(xmf, "            %d 0 0 0 %d\n", n, c);
+                fprintf(xmf, "            1 1 1 1 1\n");
+                fprintf(xmf, "            1 %d %d %d 1\n", dims[0], dims[1], dims[2]);
+                fprintf(xmf, "           </DataItem>\n");
+                fprintf(xmf, "           <DataItem Dimensions=\"&NT; %d %d %d %d\" NumberType=\"Float\" Precision=\"%d\" Format=\"HDF\">\n", dims[0], dims[1], dims[2], dims[3], (int)sizeof(Real));
+                fprintf(xmf, "            %s:/data\n", (f_name+".h5").c_str());
+                fprintf(xmf, "           </DataItem>\n");
+                fprintf(xmf, "         </DataItem>\n");
+                fprintf(xmf, "       </Attribute>\n");
+            }
+            fprintf(xmf, "     </Grid>\n");
+            xmf_end = ftell(xmf);
+
+            fprintf(xmf, "   </Grid>\n");
+            fprintf(xmf, " </Domain>\n");
+            fprintf(xmf, "</Xdmf>\n");
+            fclose(xmf);
+        }
+
+
+    public:
+
+        /* *
+         * Collective over MPI_COMM_WORLD.  The plane is normal to axis (0: x,
+         * 1: y, 2: z) through the grid points closest to the physical
+         * coordinate pos, written to <path>/<basename>_<x|y|z><index>.h5.
+         * The channels, deflate and shuffle of opt are used.
+         * */
+        PlaneDumpHDF5_MPI(TGrid& G, const int axis_, const double pos, const std::string basename="plane", const std::string path=".", const HDF5DumpOptions& opt=HDF5DumpOptions()) :
+            grid(G), axis(axis_), index(0), plane_comm(MPI_COMM_NULL), plane_bytes(0), dump_path(path), xmf_end(0)
+        {
+            if (axis < 0 || axis > 2)
+            {
+                fprintf(stderr, "[PlaneDumpHDF5_MPI ERROR: Unknown plane axis %d\n", axis);
+                exit(1);
+            }
+
+            const unsigned int N[3] = {TGrid::sizeX, TGrid::sizeY, TGrid::sizeZ};
+            const unsigned int Gmax = grid.getBlocksPerDimension(axis) * N[axis] - 1;
+            const double h = grid.getH();
+            index = (unsigned int)std::min((double)Gmax, std::max(0.0, std::floor(pos/h + 0.5)));
+
+            // the plane is the region of interest one grid point thick
+            HDF5DumpOptions popt;
+            popt.channels = opt.channels;
+            popt.roi = true;
+            for (int i = 0; i < 3; ++i)
+            {
+                popt.roi_start[i] = 0;
+                popt.roi_end[i]   = grid.getBlocksPerDimension(i) * N[i] * h;
+            }
+            popt.roi_start[axis] = (index + 0.25) * h;
+            popt.roi_end[axis]   = (index + 0.75) * h;
+            layout = _dump_layout<TGrid, Streamer>(grid, popt);
+            layout.selective = true;
+
+            char name[256];
+            sprintf(name, "%s_%c%04d", basename.c_str(), "xyz"[axis], index);
+            f_name = name;
+
+            int rank;
+            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+            MPI_Comm_split(MPI_COMM_WORLD, layout.empty() ? MPI_UNDEFINED : 0, rank, &plane_comm);
+            if (MPI_COMM_NULL == plane_comm) return;
+
+            plane_bytes = sizeof(Real) * layout.points(layout.count[2]) * layout.nchannels();
+            buffers.push_back(new Real[plane_bytes / sizeof(Real)]);
+            HostMemory::allocate(HostMemory::DUMP, plane_bytes);
+            _create(opt);
+        }
+
+        // collective over the intersecting ranks (pending planes are written)
+        ~PlaneDumpHDF5_MPI()
+        {
+            if (MPI_COMM_NULL == plane_comm) return;
+            flush();
+#ifdef _USE_HDF_
+            H5Dclose(dataset_id);
+            H5Pclose(xfer_id);
+            H5Fclose(file_id);
+#endif
+            for (size_t i = 0; i < buffers.size(); ++i)
+                delete [] buffers[i];
+            HostMemory::release(HostMemory::DUMP, buffers.size() * plane_bytes);
+            MPI_Comm_free(&plane_comm);
+        }
+
+        // samples the plane of the current state, written by the next flush()
+        void defer(const int step, const double t)
+        {
+            if (MPI_COMM_NULL == plane_comm) return;
+
+            const size_t n = pending_steps.size();
+            if (n == buffers.size())
+            {
+                buffers.push_back(new Real[plane_bytes / sizeof(Real)]);
+                HostMemory::allocate(HostMemory::DUMP, plane_bytes);
+            }
+            StreamHDF5<TGrid, Streamer>(grid, buffers[n], layout, 0, layout.count[2]);
+            pending_steps.push_back(step);
+            pending_times.push_back(t);
+        }
+
+        // collective over the intersecting ranks, no-op on all others:
+        // appends the pending planes to the file
+        void flush()
+        {
+            if (MPI_COMM_NULL == plane_comm || pending_steps.empty()) return;
+
+#ifdef _USE_HDF_
+            const hsize_t NT = steps.size();
+            const hsize_t NP = pending_steps.size();
+            const hsize_t dims[5] = {NT+NP, layout.dims[2], layout.dims[1], layout.dims[0], layout.nchannels()};
+            const hsize_t count[5] = {1, layout.count[2], layout.count[1], layout.count[0], layout.nchannels()};
+            H5Dset_extent(dataset_id, dims);
+
+            const hid_t fspace_id = H5Dget_space(dataset_id);
+            const hid_t mspace_id = H5Screate_simple(5, count, NULL);
+            for (hsize_t n = 0; n < NP; ++n)
+            {
+                const hsize_t offset[5] = {NT+n, layout.offset[2], layout.offset[1], layout.offset[0], 0};
+                H5Sselect_hyperslab(fspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
+                H5Dwrite(dataset_id, HDF_REAL, mspace_id, fspace_id, xfer_id, buffers[n]);
+            }
+            H5Sclose(mspace_id);
+            H5Sclose(fspace_id);
+
+            // keep the file readable while the run continues
+            H5Fflush(file_id, H5F_SCOPE_LOCAL);
+#endif
+
+            int rank;
+            MPI_Comm_rank(plane_comm, &rank);
+            for (size_t n = 0; n < pending_steps.size(); ++n)
+            {
+                steps.push_back(pending_steps[n]);
+                times.push_back(pending_times[n]);
+                if (rank == 0) _appendXMF();
+            }
+            pending_steps.clear();
+            pending_times.clear();
+        }
+
+        // collective over the intersecting ranks, no-op on all others
+        void append(const int step, const double t)
+        {
+            defer(step, t);
+            flush();
+        }
+
+        inline bool intersecting() const { return MPI_COMM_NULL != plane_comm; }
+        inline unsigned int getIndex() const { return index; }
+        inline const std::string& getName() const { return f_name; }
+};
@@ -22,6 +22,8 @@ using namespace std;
 #include "WaveletCompressor.h"
 
 #include "CompressionEncoders.h"
+#include "HostMemory.h"
+#include "IOGroup_MPI.h"
 
 template<typename GridType, typename IterativeStreamer>
 class SerializerIO_WaveletCompression_MPI_SimpleBlocking
@@ -59,9 +61,11 @@ protected:
     vector< size_t > lut_compression; //tells the number of compressed chunk, and where do they start, nchunks + 2
     vector< unsigned char > allmydata; //buffer with the compressed data
     size_t written_bytes, pending_writes, completed_writes;
+    size_t accounted_bytes; // allmydata and workbuffer, see HostMemory
 
     Real threshold;
     bool halffloat, verbosity;
+    int iogroup; // ranks per aggregator, see IOGroup_MPI
 
     vector< float > workload_total, workload_fwt, workload_encode; //per-thread cpu time for imbalance insight for fwt and encoding
     vector<CompressionBuffer> workbuffer; //per-thread compression buffer
@@ -155,10 +159,8 @@ protected:
 
             int mybytes = 0, myhotblocks = 0;
 
-            int mycoords[3];
-            inputGrid.peindex(mycoords);
-
-            const int NBLOCKS = 1;
+            const vector<typename GridType::SubBlockInfo>& infos = inputGrid.getBlocksInfo();
+            const int NBLOCKS = infos.size();
 
             float tfwt = 0, tencode = 0;
             Timer timer;
@@ -171,16 +173,17 @@ protected:
 
                 //wavelet compression
                 {
-                    /* FluidBlock& b = *(FluidBlock*)vInfo[i].ptrBlock; */
+                    const int * const start = infos[i].start;
+                    assert(infos[i].size[0] == _BLOCKSIZE_ && infos[i].size[1] == _BLOCKSIZE_ && infos[i].size[2] == _BLOCKSIZE_);
 
                     WaveletCompressor compressor;
 
                     Real * const mysoabuffer = &compressor.uncompressed_data()[0][0][0];
 
-                    for(int iz=0; iz<GridType::sizeZ; iz++)
-                        for(int iy=0; iy<GridType::sizeY; iy++)
-                            for(int ix=0; ix<GridType::sizeX; ix++)
-                                mysoabuffer[ix + _BLOCKSIZE_ * (iy + _BLOCKSIZE_ * iz)] = streamer.template operate<channel>(ix, iy, iz);
+                    for(int iz=0; iz<_BLOCKSIZE_; iz++)
+                        for(int iy=0; iy<_BLOCKSIZE_; iy++)
+                            for(int ix=0; ix<_BLOCKSIZE_; ix++)
+                                mysoabuffer[ix + _BLOCKSIZE_ * (iy + _BLOCKSIZE_ * iz)] = streamer.template operate<channel>(start[0]+ix, start[1]+iy, start[2]+iz);
 
                     //wavelet digestion
                     const int nbytes = (int)compressor.compress(this->threshold, this->halffloat);
@@ -195,8 +198,7 @@ protected:
 
                 //building the meta data
                 {
-                    BlockMetadata curr = { i, myhotblocks, mycoords[0], mycoords[1], mycoords[2] };
-                    /* BlockMetadata curr = { i, myhotblocks, vInfo[i].index[0], vInfo[i].index[1], vInfo[i].index[2]}; */
+                    BlockMetadata curr = { i, myhotblocks, infos[i].index[0], infos[i].index[1], infos[i].index[2]};
                     mybuf.hotblocks[myhotblocks] = curr;
                     myhotblocks++;
                 }
@@ -215,8 +217,132 @@ protected:
     }
 
 
+    // write the member pieces gathered in buf (consecutive, in member order)
+    // at offsets[m], pieces adjacent in the file are written at once
+    static void _write_runs(MPI_File myfile, const unsigned char * const buf, const vector<size_t>& offsets, const vector<size_t>& bytes)
+    {
+        size_t start = 0, pos = 0;
+        for (size_t m = 0; m < offsets.size(); ++m)
+        {
+            const size_t end = pos + bytes[m];
+            const bool last = m + 1 == offsets.size() || offsets[m+1] != offsets[m] + bytes[m];
+            if (last)
+            {
+                IOGroup_MPI::write_at(myfile, offsets[m] + bytes[m] - (end - start), buf + start, end - start);
+                start = end;
+            }
+            pos = end;
+        }
+    }
+
+    /* *
+     * Same file as _to_file, written by the aggregators of the I/O groups
+     * only: the members send their compressed data, block metadata and LUT
+     * header to the aggregator, which writes them with independent
+     * contiguous writes (one per run of consecutive ranks).
+     * */
+    void _to_file_aggregated(const MPI_Comm& mycomm, const string fileName)
+    {
+        int mygid, nranks;
+        MPI_Comm_size(mycomm, &nranks);
+        MPI_Comm_rank(mycomm, &mygid);
+
+        const IOGroup_MPI io(iogroup, mycomm);
+
+        size_t myfileoffset = 0;
+        MPI_Exscan(&written_bytes, &myfileoffset, 1, MPI_UINT64_T, MPI_SUM, mycomm);
+        if (mygid == 0)
+            myfileoffset = 0;
+        size_t total_written_bytes = myfileoffset + written_bytes;
+        MPI_Bcast(&total_written_bytes, 1, MPI_UINT64_T, nranks - 1, mycomm);
+
+        const size_t metadata_bytes = myblockindices.size() * sizeof(BlockMetadata);
+        const size_t lutheader_bytes = sizeof(lutheader);
+
+        // gid, ocean offset and bytes of the members
+        const size_t mine[3] = {(size_t)mygid, myfileoffset, written_bytes};
+        vector<size_t> members(3 * io.group_size);
+        MPI_Gather(const_cast<size_t *>(mine), 3, MPI_UINT64_T, &members.front(), 3, MPI_UINT64_T, 0, io.group_comm);
+
+        vector<size_t> gids(io.group_size), ocean_offsets(io.group_size), ocean_bytes(io.group_size);
+        size_t ocean_total = 0;
+        for (int m = 0; m < io.group_size; ++m)
+        {
+            gids[m]          = members[3*m+0];
+            ocean_offsets[m] = members[3*m+1];
+            ocean_bytes[m]   = members[3*m+2];
+            ocean_total     += ocean_bytes[m];
+        }
+
+        vector<unsigned char> ocean(io.writer() ? std::max((size_t)1, ocean_total) : 0);
+        vector<unsigned char> metadata(io.writer() ? std::max((size_t)1, metadata_bytes * io.group_size) : 0);
+        vector<unsigned char> luts(io.writer() ? lutheader_bytes * io.group_size : 0);
+        HostMemory::allocate(HostMemory::COMPRESSION, ocean.size() + metadata.size());
+        io.gather(&allmydata.front(), written_bytes, io.writer() ? &ocean.front() : NULL, &ocean_bytes.front());
+        io.gather(&myblockindices.front(), metadata_bytes, io.writer() ? &metadata.front() : NULL, &vector<size_t>(io.group_size, metadata_bytes).front());
+        io.gather(&lutheader, lutheader_bytes, io.writer() ? &luts.front() : NULL, &vector<size_t>(io.group_size, lutheader_bytes).front());
+
+        if (io.writer())
+        {
+            MPI_Info myfileinfo;
+            MPI_Info_create(&myfileinfo);
+            MPI_Info_set(myfileinfo, "access_syle", "write_once");
+
+            MPI_File myfile;
+            MPI_File_open(io.writer_comm, const_cast<char *>(fileName.c_str()), MPI_MODE_WRONLY | MPI_MODE_CREATE, myfileinfo, &myfile);
+            MPI_Status status;
+
+            size_t blank_address = -1;
+            size_t current_displacement = sizeof(blank_address) + binaryocean_title.size();
+
+            // the binary ocean
+            vector<size_t> offsets(io.group_size);
+            for (int m = 0; m < io.group_size; ++m)
+                offsets[m] = current_displacement + ocean_offsets[m];
+            _write_runs(myfile, &ocean.front(), offsets, ocean_bytes);
+            current_displacement += total_written_bytes;
+
+            // mini-header and header
+            const size_t header_bytes = header.size();
+            if (mygid == 0)
+            {
+                MPI_File_write(myfile, &current_displacement, sizeof(current_displacement), MPI_CHAR, &status);
+                MPI_File_write(myfile, const_cast<char *>(binaryocean_title.c_str()), binaryocean_title.size(), MPI_CHAR, &status);
+                MPI_File_write_at(myfile, current_displacement, const_cast<char *>(header.c_str()), header_bytes, MPI_CHAR, &status);
+            }
+            current_displacement += header_bytes;
+
+            // block metadata
+            for (int m = 0; m < io.group_size; ++m)
+                offsets[m] = current_displacement + gids[m] * metadata_bytes;
+            _write_runs(myfile, &metadata.front(), offsets, vector<size_t>(io.group_size, metadata_bytes));
+            current_displacement += metadata_bytes * nranks;
+
+            // lut title and local buffer entries
+            const int title_bytes = binarylut_title.size();
+            if (mygid == 0)
+                MPI_File_write_at(myfile, current_displacement, const_cast<char *>(binarylut_title.c_str()), title_bytes, MPI_CHAR, &status);
+            current_displacement += title_bytes;
+
+            assert(lut_compression.size() == 0);
+            for (int m = 0; m < io.group_size; ++m)
+                offsets[m] = current_displacement + gids[m] * lutheader_bytes;
+            _write_runs(myfile, &luts.front(), offsets, vector<size_t>(io.group_size, lutheader_bytes));
+
+            MPI_File_close(&myfile);
+            MPI_Info_free(&myfileinfo);
+        }
+        HostMemory::release(HostMemory::COMPRESSION, ocean.size() + metadata.size());
+    }
+
     virtual void _to_file(const MPI_Comm& mycomm, const string fileName)
     {
+        if (iogroup != 1)
+        {
+            _to_file_aggregated(mycomm, fileName);
+            return;
+        }
+
         int mygid, nranks;
         MPI_Comm_size(mycomm, &nranks);
         MPI_Comm_rank(mycomm, &mygid);
@@ -336,9 +462,7 @@ protected:
     void _write(GridType & inputGrid, string fileName, IterativeStreamer streamer)
     {
         //MPI grid, that is
-        /* const vector<BlockInfo> infos = inputGrid.getBlocksInfo(); */
-        /* const int NBLOCKS = infos.size(); */
-        const int NBLOCKS = 1;
+        const int NBLOCKS = inputGrid.getBlocksInfo().size();
 
         //prepare the headers
         {
@@ -346,16 +470,13 @@ protected:
             this->binarylut_title = "\n==============START-BINARY-LUT==============\n";
 
             {
-                const int xtotalbpd = inputGrid.getBlocksPerDimension(0);
-                const int ytotalbpd = inputGrid.getBlocksPerDimension(1);
-                const int ztotalbpd = inputGrid.getBlocksPerDimension(2);
+                const int xbpd = inputGrid.getResidentBlocksPerDimension(0);
+                const int ybpd = inputGrid.getResidentBlocksPerDimension(1);
+                const int zbpd = inputGrid.getResidentBlocksPerDimension(2);
 
-                const int xbpd = 1; //only one block in each subdomain
-                const int ybpd = 1;
-                const int zbpd = 1;
-                /* const int xbpd = inputGrid.getResidentBlocksPerDimension(0); */
-                /* const int ybpd = inputGrid.getResidentBlocksPerDimension(1); */
-                /* const int zbpd = inputGrid.getResidentBlocksPerDimension(2); */
+                const int xtotalbpd = inputGrid.getBlocksPerDimension(0) * xbpd;
+                const int ytotalbpd = inputGrid.getBlocksPerDimension(1) * ybpd;
+                const int ztotalbpd = inputGrid.getBlocksPerDimension(2) * zbpd;
 
                 const double xExtent = inputGrid.getH()*(xtotalbpd*_BLOCKSIZE_ - 1);
                 const double yExtent = inputGrid.getH()*(ytotalbpd*_BLOCKSIZE_ - 1);
@@ -428,6 +549,8 @@ protected:
 
                 written_bytes += extrabytes;
             }
+
+            HostMemory::resize(HostMemory::COMPRESSION, accounted_bytes, allmydata.capacity() + workbuffer.size() * sizeof(CompressionBuffer));
         }
 
         /* const MPI::Intracomm& mycomm = inputGrid.getCartComm(); */
@@ -774,12 +897,21 @@ public:
 
     void verbose() { verbosity = true; }
 
+    // two-phase writing: groupsize ranks per aggregator (1: every rank
+    // writes, 0: one aggregator per node)
+    void set_iogroup(const int groupsize) { iogroup = groupsize; }
+
     SerializerIO_WaveletCompression_MPI_SimpleBlocking():
-    threshold(0), halffloat(false), verbosity(false),
+    threshold(0), halffloat(false), verbosity(false), iogroup(1),
     workload_total(omp_get_max_threads()), workload_fwt(omp_get_max_threads()), workload_encode(omp_get_max_threads()),
     workbuffer(omp_get_max_threads()),
-    written_bytes(0), pending_writes(0)
+    written_bytes(0), pending_writes(0), accounted_bytes(0)
+    {
+    }
+
+    ~SerializerIO_WaveletCompression_MPI_SimpleBlocking()
     {
+        HostMemory::release(HostMemory::COMPRESSION, accounted_bytes);
     }
 
     template< int channel >
@@ -45,16 +45,22 @@ double LSRK3_IntegratorMPI::operator()(const double dt_max)
         GPU->load_ghosts();
         trk1 = GPU->process_all(0, 1./4, dt/h);
         if (verbosity) printf("RK stage 1 takes %f sec\n", trk1);
+        if (verbosity && GPU->halo_encoded()) printf("RK stage 1 halo encoding ratio %f\n", GPU->halo_encoding_ratio());
+        if (verbosity && GPU->tmp_reduced()) printf("RK stage 1 tmp rounding error %e\n", GPU->tmp_rounding_error());
     }
     {// stage 2
         GPU->load_ghosts();
         trk2 = GPU->process_all(-17./32, 8./9, dt/h);
         if (verbosity) printf("RK stage 2 takes %f sec\n", trk2);
+        if (verbosity && GPU->halo_encoded()) printf("RK stage 2 halo encoding ratio %f\n", GPU->halo_encoding_ratio());
+        if (verbosity && GPU->tmp_reduced()) printf("RK stage 2 tmp rounding error %e\n", GPU->tmp_rounding_error());
     }
     {// stage 3
         GPU->load_ghosts();
         trk3 = GPU->process_all(-32./27, 3./4, dt/h);
         if (verbosity) printf("RK stage 3 takes %f sec\n", trk3);
+        if (verbosity && GPU->halo_encoded()) printf("RK stage 3 halo encoding ratio %f\n", GPU->halo_encoding_ratio());
+        if (verbosity && GPU->tmp_reduced()) printf("RK stage 3 tmp rounding error %e\n", GPU->tmp_rounding_error());
     }
     if (verbosity) printf("netto step takes %f sec\n", tsos + trk1 + trk2 + trk3);
 
@@ -20,8 +20,9 @@ Real MaxSpeedOfSound_CPP::compute(const RealPtrVec_t& src) const
     const int N = _BLOCKSIZEX_ * _BLOCKSIZEY_ * _BLOCKSIZEZ_;
     Real sos = 0;
 
-    for(int i=0; i<N; ++i)
+    for(int k=0; k<N; ++k)
     {
+        const int i = NodeBlock::Layout::entry(k);
         const Real r = src[0][i];
         const Real u = src[1][i];
         const Real v = src[2][i];
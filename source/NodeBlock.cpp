@@ -5,8 +5,12 @@
  * Copyright 2014 ETH Zurich. All rights reserved.
  * */
 #include "NodeBlock.h"
+#include "HostMemory.h"
 #include <stdlib.h>
 #include <cmath>
+#ifdef _USE_HUGEPAGES_
+#include <sys/mman.h>
+#endif
 using namespace std;
 
 
@@ -14,49 +18,105 @@ using namespace std;
 #define _ALIGNBYTES_ 16
 #endif
 
-static void _allocate_aligned(void **memptr, size_t alignment, size_t bytes)
+// Fields are page aligned such that the parallel first touch in clear_data()
+// and clear_tmp() places whole pages.  With huge pages (make hugepages=1),
+// fields are aligned and padded to 2 MiB and transparent huge pages are
+// requested.
+#ifdef _USE_HUGEPAGES_
+static const size_t _PAGEBYTES_ = 2*1024*1024;
+#else
+static const size_t _PAGEBYTES_ = 4096;
+#endif
+
+static size_t _allocate_aligned(void **memptr, size_t alignment, size_t bytes)
 {
-    const int retval = posix_memalign(memptr, alignment, bytes);
+    const size_t padded = (bytes + _PAGEBYTES_ - 1) / _PAGEBYTES_ * _PAGEBYTES_;
+    const int retval = posix_memalign(memptr, max(alignment, _PAGEBYTES_), padded);
     assert(retval == 0);
+#ifdef _USE_HUGEPAGES_
+    madvise(*memptr, padded, MADV_HUGEPAGE);
+#endif
+    return padded;
 }
 
 void NodeBlock::_alloc()
 {
     const int N = sizeX * sizeY * sizeZ;
+#if defined(_USE_AOSOA_)
+    // interleaved variables, see AoSoALayout
+    slab_stride = Layout::varstride;
+    alloc_bytes += _allocate_aligned((void **)&data_slab, max(8, _ALIGNBYTES_), sizeof(Real) * NVAR * N);
+    alloc_bytes += _allocate_aligned((void **)&tmp_slab,  max(8, _ALIGNBYTES_), sizeof(TmpReal) * NVAR * N);
     for (int var = 0; var < NVAR; ++var)
     {
-        _allocate_aligned((void **)&data[var], max(8, _ALIGNBYTES_), sizeof(Real) * N);
-        _allocate_aligned((void **)&tmp[var],  max(8, _ALIGNBYTES_), sizeof(Real) * N);
+        data[var] = data_slab + var * slab_stride;
+        tmp[var]  = tmp_slab  + var * slab_stride;
     }
+#elif defined(_USE_SLAB_)
+    // one slab for all variables, the stride is padded to keep every
+    // variable aligned (TmpReal is the smaller type)
+    const int align = max(8, _ALIGNBYTES_) / sizeof(TmpReal);
+    slab_stride = (N + align - 1) / align * align;
+    alloc_bytes += _allocate_aligned((void **)&data_slab, max(8, _ALIGNBYTES_), sizeof(Real) * NVAR * slab_stride);
+    alloc_bytes += _allocate_aligned((void **)&tmp_slab,  max(8, _ALIGNBYTES_), sizeof(TmpReal) * NVAR * slab_stride);
+    for (int var = 0; var < NVAR; ++var)
+    {
+        data[var] = data_slab + var * slab_stride;
+        tmp[var]  = tmp_slab  + var * slab_stride;
+    }
+#else
+    for (int var = 0; var < NVAR; ++var)
+    {
+        alloc_bytes += _allocate_aligned((void **)&data[var], max(8, _ALIGNBYTES_), sizeof(Real) * N);
+        alloc_bytes += _allocate_aligned((void **)&tmp[var],  max(8, _ALIGNBYTES_), sizeof(TmpReal) * N);
+    }
+#endif
+    HostMemory::allocate(HostMemory::GRID, alloc_bytes);
 }
 
 void NodeBlock::_dealloc()
 {
+    HostMemory::release(HostMemory::GRID, alloc_bytes);
+    alloc_bytes = 0;
+
+#if defined(_USE_SLAB_) || defined(_USE_AOSOA_)
+    free(data_slab);
+    free(tmp_slab);
+#else
     for (int var = 0; var < NVAR; ++var)
     {
         free(data[var]);
         free(tmp[var]);
     }
+#endif
 }
 
+// First touch: the z-slabs are distributed over threads in the same way as in
+// the host loops (chunk staging, halo extraction, boundary conditions,
+// streamers), all of them parallelize the outer iz loop with a static
+// schedule (collapsed with the variables where there are only 3 slabs).
 void NodeBlock::clear_data()
 {
-    const int N = sizeX * sizeY * sizeZ;
+    const int SLICE = sizeX * sizeY;
     for (int var = 0; var < NVAR; ++var)
     {
         Real *pdata = data[var];
-        for (int i = 0; i < N; ++i)
-            pdata[i] = static_cast<Real>(0.0);
+#pragma omp parallel for schedule(static)
+        for (int iz = 0; iz < sizeZ; ++iz)
+            for (int i = 0; i < SLICE; ++i)
+                pdata[Layout::entry(i + SLICE * iz)] = static_cast<Real>(0.0);
     }
 }
 
 void NodeBlock::clear_tmp()
 {
-    const int N = sizeX * sizeY * sizeZ;
+    const int SLICE = sizeX * sizeY;
     for (int var = 0; var < NVAR; ++var)
     {
-        Real *ptmp = tmp[var];
-        for (int i = 0; i < N; ++i)
-            ptmp[i] = static_cast<Real>(0.0);
+        TmpReal *ptmp = tmp[var];
+#pragma omp parallel for schedule(static)
+        for (int iz = 0; iz < sizeZ; ++iz)
+            for (int i = 0; i < SLICE; ++i)
+                ptmp[Layout::entry(i + SLICE * iz)] = static_cast<Real>(0.0);
     }
 }
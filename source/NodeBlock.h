@@ -7,6 +7,7 @@
 #pragma once
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <cmath>
 #include <vector>
@@ -18,6 +19,103 @@ typedef float Real;
 typedef double Real;
 #endif
 
+// bfloat16 storage type, converts from/to float (round to nearest even)
+struct bfloat16
+{
+    unsigned short bits;
+
+    bfloat16() { }
+    bfloat16(const float f)
+    {
+        unsigned int u;
+        memcpy(&u, &f, sizeof(u));
+        u += 0x7fff + ((u >> 16) & 1);
+        bits = u >> 16;
+    }
+    operator float() const
+    {
+        const unsigned int u = static_cast<unsigned int>(bits) << 16;
+        float f;
+        memcpy(&f, &u, sizeof(f));
+        return f;
+    }
+};
+
+// Storage type of the low-storage RK register (tmp):  full precision
+// (default), float (-D_TMP_FLOAT_) or bfloat16 (-D_TMP_BF16_)
+#if defined(_TMP_BF16_)
+typedef bfloat16 TmpReal;
+#elif defined(_TMP_FLOAT_)
+typedef float TmpReal;
+#else
+typedef Real TmpReal;
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+// MEMORY LAYOUT OF THE FIELDS
+///////////////////////////////////////////////////////////////////////////////
+template <int NX, int NY, int NZ>
+struct LinearLayout
+{
+    // x-fastest lexicographic ordering
+    static const bool linear = true;
+    static const int varstride = NX * NY * NZ;
+    static inline unsigned int idx(const unsigned int ix, const unsigned int iy, const unsigned int iz)
+    {
+        return ix + NX * (iy + NY * iz);
+    }
+    // offset of the i-th cell in storage order (loops over all cells)
+    static inline unsigned int entry(const unsigned int i) { return i; }
+};
+
+template <int NX, int NY, int NZ, int B>
+struct BrickLayout
+{
+    // bricks of B^3 cells, the bricks as well as the cells within a brick
+    // are ordered x-fastest.  A z-slab of B slices is contiguous in memory.
+    static const bool linear = false;
+    typedef char _check_bricksize[(NX%B == 0 && NY%B == 0 && NZ%B == 0) ? 1 : -1];
+    static inline unsigned int idx(const unsigned int ix, const unsigned int iy, const unsigned int iz)
+    {
+        const unsigned int brick = ix/B + (NX/B) * (iy/B + (NY/B) * (iz/B));
+        const unsigned int cell  = ix%B + B * (iy%B + B * (iz%B));
+        return cell + B*B*B * brick;
+    }
+    static inline unsigned int entry(const unsigned int i) { return i; }
+};
+
+template <int NX, int NY, int NZ, int W, int NVAR>
+struct AoSoALayout
+{
+    // x-fastest cells, variables are interleaved in packets of W cells:
+    // [r_0..r_W-1, u_0..u_W-1, ..., P_0..P_W-1, r_W..r_2W-1, ...].  The
+    // pointer of variable p is base + p*W, its cells are at entry().
+    static const bool linear = false;
+    static const int varstride = W;
+    typedef char _check_packetsize[((NX*NY*NZ)%W == 0) ? 1 : -1];
+    static inline unsigned int entry(const unsigned int i)
+    {
+        return (i/W) * (NVAR*W) + i%W;
+    }
+    static inline unsigned int idx(const unsigned int ix, const unsigned int iy, const unsigned int iz)
+    {
+        return entry(ix + NX * (iy + NY * iz));
+    }
+};
+
+#ifndef _BRICKSIZE_
+#define _BRICKSIZE_ 8
+#endif
+
+#ifndef _AOSOA_WIDTH_
+#define _AOSOA_WIDTH_ 4
+#endif
+
+#if defined(_USE_BRICKS_) && defined(_USE_AOSOA_)
+#error "_USE_BRICKS_ and _USE_AOSOA_ are mutually exclusive"
+#endif
+
 
 class NodeBlock
 {
@@ -35,6 +133,20 @@ class NodeBlock
         static const int sizeY = _BLOCKSIZEY_;
         static const int sizeZ = _BLOCKSIZEZ_;
 
+#if defined(_USE_BRICKS_)
+        typedef BrickLayout<_BLOCKSIZEX_, _BLOCKSIZEY_, _BLOCKSIZEZ_, _BRICKSIZE_> Layout;
+#elif defined(_USE_AOSOA_)
+        typedef AoSoALayout<_BLOCKSIZEX_, _BLOCKSIZEY_, _BLOCKSIZEZ_, _AOSOA_WIDTH_, NVAR> Layout;
+#else
+        typedef LinearLayout<_BLOCKSIZEX_, _BLOCKSIZEY_, _BLOCKSIZEZ_> Layout;
+#endif
+
+        // index of cell (ix,iy,iz) in any of the data/tmp fields
+        static inline unsigned int linaccess(const unsigned int ix, const unsigned int iy, const unsigned int iz)
+        {
+            return Layout::idx(ix, iy, iz);
+        }
+
 
     protected:
 
@@ -45,18 +157,26 @@ class NodeBlock
 
         // Fluid data and tmp storage
         std::vector<Real *> data;
-        std::vector<Real *> tmp;
+        std::vector<TmpReal *> tmp;
+
+        // with -D_USE_SLAB_ (or -D_USE_AOSOA_), all variables of data (tmp)
+        // are stored in a single allocation, data[var] = data_slab + var *
+        // slab_stride
+        Real *data_slab;
+        TmpReal *tmp_slab;
+        unsigned int slab_stride;
 
         inline unsigned int _linaccess(const unsigned int ix, const unsigned int iy, const unsigned int iz)
         {
             assert(ix < sizeX);
             assert(iy < sizeY);
             assert(iz < sizeZ);
-            return (ix + sizeX * (iy + sizeY * iz));
+            return Layout::idx(ix, iy, iz);
         }
 
 
     private:
+        size_t alloc_bytes; // accounted in HostMemory
         void _alloc();
         void _dealloc();
 
@@ -66,7 +186,8 @@ class NodeBlock
         NodeBlock(const double maxextent = 1.0)
             :
                 //origin{0.0, 0.0, 0.0}, // nvcc does not like this
-                data(NVAR, NULL), tmp(NVAR, NULL)
+                data(NVAR, NULL), tmp(NVAR, NULL),
+                data_slab(NULL), tmp_slab(NULL), slab_stride(0), alloc_bytes(0)
         {
             h = maxextent / (std::max(_BLOCKSIZEX_, std::max(_BLOCKSIZEY_, _BLOCKSIZEZ_)));
             origin[0] = origin[1] = origin[2] = 0.0;
@@ -108,9 +229,14 @@ class NodeBlock
         }
 
         inline const std::vector<Real *>& pdata() const { return data; }
-        inline const std::vector<Real *>& ptmp()  const { return tmp; }
+        inline const std::vector<TmpReal *>& ptmp()  const { return tmp; }
         inline std::vector<Real *>& pdata() { return data; }
-        inline std::vector<Real *>& ptmp()  { return tmp; }
+        inline std::vector<TmpReal *>& ptmp()  { return tmp; }
+
+        // contiguous storage of all variables (NULL if not allocated as slab)
+        inline Real * pdata_slab() const { return data_slab; }
+        inline TmpReal * ptmp_slab()  const { return tmp_slab; }
+        inline unsigned int stride_slab() const { return slab_stride; }
 
         inline Real& operator()(const unsigned int ix, const unsigned int iy, const unsigned int iz, const PRIM p)
         {
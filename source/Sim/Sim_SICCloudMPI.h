@@ -311,7 +311,7 @@ class GPUlabSICCloud : public GPUlab
     protected:
         void _apply_bc(const double t = 0)
         {
-            BoundaryConditions<GridMPI> bc(grid.pdata());
+            BoundaryConditions<GridMPI> bc(grid.pdata(), bc_iz, bc_nslices);
             if (myFeature[0] == SKIN) bc.template applyBC_absorbing<0,0,ghostmap::X>(halox.left);
             if (myFeature[1] == SKIN) bc.template applyBC_absorbing<0,1,ghostmap::X>(halox.right);
             if (myFeature[2] == SKIN) bc.template applyBC_absorbing<1,0,ghostmap::Y>(haloy.left);
@@ -61,13 +61,19 @@ Sim_StaticIC::Sim_StaticIC(const int argc, const char **argv, const int isroot)
 
 void Sim_StaticIC::_setup()
 {
-    npex = parser("-npex").asInt(1);
-    npey = parser("-npey").asInt(1);
-    npez = parser("-npez").asInt(1);
+    // -npe auto: process grid chosen by GridMPI (0 entries are free)
+    const bool autope = parser("-npe").asString("manual") == "auto";
+    npex = parser("-npex").asInt(autope ? 0 : 1);
+    npey = parser("-npey").asInt(autope ? 0 : 1);
+    npez = parser("-npez").asInt(autope ? 0 : 1);
     filename = parser("-fname").asString("staticIC");
 
     mygrid = new GridMPI(npex, npey, npez);
     assert(mygrid != NULL);
+    npex = mygrid->getBlocksPerDimension(0);
+    npey = mygrid->getBlocksPerDimension(1);
+    npez = mygrid->getBlocksPerDimension(2);
+    if (isroot) printf("Process grid: %dx%dx%d\n", npex, npey, npez);
     _ic();
     _dump(filename);
 }
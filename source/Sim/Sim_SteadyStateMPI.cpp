@@ -7,19 +7,20 @@
 #include <cassert>
 #include <omp.h>
 #include <string>
-#include <fstream>
-#include <iomanip>
+#include <sstream>
 
 #include "Sim_SteadyStateMPI.h"
 #include "LSRK3_IntegratorMPI.h"
 #include "HDF5Dumper_MPI.h"
+#include "Checkpoint_MPI.h"
+#include "HostMemory.h"
 /* #include "SerializerIO_WaveletCompression_MPI_Simple.h" */
 
 using namespace std;
 
 
 Sim_SteadyStateMPI::Sim_SteadyStateMPI(const int argc, const char ** argv, const int isroot_)
-    : isroot(isroot_), t(0.0), step(0), fcount(0), mygrid(NULL), myGPU(NULL), parser(argc, argv)
+    : isroot(isroot_), t(0.0), step(0), fcount(0), mygrid(NULL), myGPU(NULL), mydumper(NULL), myseries(NULL), planeinterval(0), planebuffer(0), planesdeferred(0), mycheckpoint(NULL), parser(argc, argv)
 { }
 
 
@@ -44,15 +45,90 @@ void Sim_SteadyStateMPI::_setup()
     restart   = parser("-restart").asBool(false);
     nsteps    = parser("-nsteps").asInt(0);
 
+    // HDF5 dumps
+    dumpopt.nslab   = parser("-dumpslab").asInt(0);
+    dumpopt.chunked = parser("-h5chunk").asBool(false);
+    dumpopt.deflate = parser("-h5deflate").asInt(0);
+    dumpopt.shuffle = parser("-h5shuffle").asBool(false);
+    dumpopt.zfp     = parser("-h5zfp").asDouble(0);
+    // -dumpgroup N|node: ranks per aggregator for two-phase writing
+    const string group = parser("-dumpgroup").asString("1");
+    dumpopt.group   = group == "node" ? 0 : atoi(group.c_str());
+    // -dumppieces: a file per rank (per aggregator), assembled by the XDMF
+    dumpopt.pieces  = parser("-dumppieces").asBool(false);
+    // -dumpchannels p,G: selected channels (names or indices), -dumproi
+    // x0 y0 z0 x1 y1 z1: physical region of interest, -dumpstride: subsampling
+    dumpopt.channels = DumpChannels<myTensorialStreamer>(parser("-dumpchannels").asString(""));
+    dumpopt.stride   = parser("-dumpstride").asInt(1);
+    const string roi = parser("-dumproi").asString("");
+    if (!roi.empty())
+    {
+        dumpopt.roi = true;
+        if (6 != sscanf(roi.c_str(), "%lf %lf %lf %lf %lf %lf",
+                    &dumpopt.roi_start[0], &dumpopt.roi_start[1], &dumpopt.roi_start[2],
+                    &dumpopt.roi_end[0], &dumpopt.roi_end[1], &dumpopt.roi_end[2]))
+        {
+            fprintf(stderr, "[Sim_SteadyStateMPI ERROR: -dumproi expects x0 y0 z0 x1 y1 z1\n");
+            exit(1);
+        }
+    }
+
     // MPI
-    npex = parser("-npex").asInt(1);
-    npey = parser("-npey").asInt(1);
-    npez = parser("-npez").asInt(1);
+    // -npe auto: process grid chosen by GridMPI (0 entries are free)
+    const bool autope = parser("-npe").asString("manual") == "auto";
+    npex = parser("-npex").asInt(autope ? 0 : 1);
+    npey = parser("-npey").asInt(autope ? 0 : 1);
+    npez = parser("-npez").asInt(autope ? 0 : 1);
 
     // assign dependent stuff
     tnextdump = dumpinterval;
     mygrid    = new GridMPI(npex, npey, npez);
     assert(mygrid != NULL);
+    npex = mygrid->getBlocksPerDimension(0);
+    npey = mygrid->getBlocksPerDimension(1);
+    npez = mygrid->getBlocksPerDimension(2);
+    if (isroot) printf("Process grid: %dx%dx%d\n", npex, npey, npez);
+
+    if (parser("-asyncdump").asBool(false))
+        mydumper = new AsyncDumpHDF5_MPI<GridMPI, myTensorialStreamer>(*mygrid, dumpopt);
+    // -dumpseries: all dumps are datasets of data.h5, data.xmf is a
+    // temporal collection
+    if (parser("-dumpseries").asBool(false))
+        myseries = new HDF5Series_MPI("data", parser("-fpath").asString("."), mydumper ? mydumper->comm() : MPI_COMM_WORLD);
+
+    // 2D planes: -planes z:0.5 x:0.25 (normal axis and physical position)
+    planeinterval = parser("-planeinterval").asInt(1);
+    planebuffer   = parser("-planebuffer").asInt(16);
+    {
+        const string planes = parser("-planes").asString("");
+        const string dump_path = parser("-fpath").asString(".");
+        istringstream specs(planes);
+        string spec;
+        while (specs >> spec)
+        {
+            char dir;
+            double pos;
+            if (2 != sscanf(spec.c_str(), "%c:%lf", &dir, &pos) || dir < 'x' || dir > 'z')
+            {
+                fprintf(stderr, "[Sim_SteadyStateMPI ERROR: -planes expects <x|y|z>:<position>, got %s\n", spec.c_str());
+                exit(1);
+            }
+            myplanes.push_back(new PlaneDumpHDF5_MPI<GridMPI, myTensorialStreamer>(*mygrid, dir - 'x', pos, "plane", dump_path, dumpopt));
+            if (isroot) printf("Plane output %s every %d steps\n", myplanes.back()->getName().c_str(), planeinterval);
+        }
+    }
+
+    // -savelocal dir: checkpoints to node-local storage, every -saveglobal
+    // N-th one is flushed to save.bin in the background, -savemirror: copy
+    // to the local storage of a partner rank
+    const string savelocal = parser("-savelocal").asString("");
+    if (!savelocal.empty())
+    {
+        const string dump_path = parser("-fpath").asString(".");
+        const int saveglobal = parser("-saveglobal").asInt(10);
+        mycheckpoint = new MultiLevelCheckpoint_MPI<GridMPI>(*mygrid, savelocal, dump_path + "/save.bin", saveglobal, parser("-savemirror").asBool(false));
+        if (isroot) printf("Checkpoints to %s, every %d-th to %s/save.bin\n", savelocal.c_str(), saveglobal, dump_path.c_str());
+    }
 
     // setup initial condition
     if (restart)
@@ -79,9 +155,14 @@ void Sim_SteadyStateMPI::_setup()
     {
         _allocGPU();
         assert(myGPU != NULL);
+        myGPU->set_halo_exchange(parser("-halo").asString("p2p"));
+        myGPU->set_halo_encoding(parser("-haloencoding").asString("none"));
+        myGPU->set_halo_stream(parser("-halostream").asBool(false));
     }
     else
         if (isroot) printf("No GPU allocated...\n");
+
+    HostMemory::report("at startup");
 }
 
 
@@ -141,7 +222,43 @@ void Sim_SteadyStateMPI::_dump(const string basename)
 
     sprintf(fname, "%s_%04d", basename.c_str(), fcount++);
     if (isroot) printf("Dumping file %s at step %d, time %f\n", fname, step, t);
-    DumpHDF5_MPI<GridMPI, myTensorialStreamer>(*mygrid, step, fname, dump_path);
+    if (mydumper)
+    {
+        _flush_planes();
+        const double waited = mydumper->dump(step, fname, dump_path, myseries);
+        if (isroot && waited > 0) printf("Waited %f sec for the previous dump\n", waited);
+    }
+    else
+        DumpHDF5_MPI<GridMPI, myTensorialStreamer>(*mygrid, step, fname, dump_path, dumpopt, myseries);
+
+    char when[256];
+    sprintf(when, "at dump %s", fname);
+    HostMemory::report(when);
+}
+
+
+void Sim_SteadyStateMPI::_planes()
+{
+    if (myplanes.empty()) return;
+    for (size_t i = 0; i < myplanes.size(); ++i)
+        myplanes[i]->defer(step, t);
+    ++planesdeferred;
+
+    // HDF5 is not used concurrently: keep the planes in memory while a
+    // background dump is written, unless the buffer is full
+    if (mydumper && planesdeferred < planebuffer && !mydumper->test())
+        return;
+    _flush_planes();
+}
+
+
+void Sim_SteadyStateMPI::_flush_planes()
+{
+    if (0 == planesdeferred) return;
+    if (mydumper) mydumper->wait();
+    for (size_t i = 0; i < myplanes.size(); ++i)
+        myplanes[i]->flush();
+    planesdeferred = 0;
 }
 
 
@@ -149,15 +266,15 @@ void Sim_SteadyStateMPI::_save()
 {
     const string dump_path = parser("-fpath").asString(".");
 
-    if (isroot)
+    // raw state of all ranks with t, step and fcount in one binary file,
+    // MPI-IO only, independent of a background HDF5 dump
+    if (mycheckpoint)
     {
-        ofstream saveinfo("save.info");
-        saveinfo << setprecision(15) << t << endl;
-        saveinfo << step << endl;
-        saveinfo << fcount << endl;
-        saveinfo.close();
+        const double waited = mycheckpoint->save(CheckpointInfo(t, step, fcount));
+        if (isroot && waited > 0) printf("Waited %f sec for the previous global checkpoint\n", waited);
     }
-    DumpHDF5_MPI<GridMPI, mySaveStreamer>(*mygrid, step, "save.data", dump_path);
+    else
+        WriteCheckpoint_MPI(*mygrid, CheckpointInfo(t, step, fcount), dump_path + "/save.bin");
 }
 
 
@@ -165,17 +282,13 @@ bool Sim_SteadyStateMPI::_restart()
 {
     const string dump_path = parser("-fpath").asString(".");
 
-    ifstream saveinfo("save.info");
-    if (saveinfo.good())
-    {
-        saveinfo >> t;
-        saveinfo >> step;
-        saveinfo >> fcount;
-        ReadHDF5_MPI<GridMPI, mySaveStreamer>(*mygrid, "save.data", dump_path);
-        return true;
-    }
-    else
+    CheckpointInfo info;
+    if (mycheckpoint ? !mycheckpoint->restart(info) : !ReadCheckpoint_MPI(*mygrid, info, dump_path + "/save.bin"))
         return false;
+    t      = info.t;
+    step   = info.step;
+    fcount = info.fcount;
+    return true;
 }
 
 
@@ -210,6 +323,8 @@ void Sim_SteadyStateMPI::run()
             }
             /* if (step % 10 == 0) _dump(); */
 
+            if (planeinterval > 0 && step % planeinterval == 0) _planes();
+
             if (step % saveinterval == 0)
             {
                 if (isroot) printf("Saving time step...\n");
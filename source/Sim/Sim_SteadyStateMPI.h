@@ -7,12 +7,16 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include "ArgumentParser.h"
 #include "Types.h"
 #include "GridMPI.h"
 #include "GPUlab.h"
 #include "BoundaryConditions.h"
+#include "AsyncDumpHDF5_MPI.h"
+#include "PlaneDumpHDF5_MPI.h"
+#include "MultiLevelCheckpoint_MPI.h"
 
 
 class Sim_SteadyStateMPI : public Simulation
@@ -35,6 +39,19 @@ class Sim_SteadyStateMPI : public Simulation
         GridMPI *mygrid;
         GPUlab  *myGPU;
 
+        // HDF5 dumps
+        HDF5DumpOptions dumpopt;
+        // background dumps (-asyncdump), NULL for synchronous dumps
+        AsyncDumpHDF5_MPI<GridMPI, myTensorialStreamer> *mydumper;
+        // all dumps in one file (-dumpseries), NULL for a file per dump
+        HDF5Series_MPI *myseries;
+        // 2D planes (-planes), appended every planeinterval steps, up to
+        // planebuffer of them are deferred while a background dump is written
+        std::vector<PlaneDumpHDF5_MPI<GridMPI, myTensorialStreamer> *> myplanes;
+        uint_t planeinterval, planebuffer, planesdeferred;
+        // node-local checkpoints (-savelocal), NULL for global checkpoints only
+        MultiLevelCheckpoint_MPI<GridMPI> *mycheckpoint;
+
         // helper
         ArgumentParser parser;
 
@@ -44,6 +61,8 @@ class Sim_SteadyStateMPI : public Simulation
 
         virtual void _dump(const std::string basename = "data");
 
+        void _planes();
+        void _flush_planes();
         void _save();
         bool _restart();
 
@@ -53,6 +72,12 @@ class Sim_SteadyStateMPI : public Simulation
         Sim_SteadyStateMPI(const int argc, const char ** argv, const int isroot);
         ~Sim_SteadyStateMPI()
         {
+            if (mydumper) mydumper->wait();
+            delete mycheckpoint;
+            delete myseries;
+            delete mydumper;
+            for (size_t i = 0; i < myplanes.size(); ++i)
+                delete myplanes[i];
             delete mygrid;
             delete myGPU;
         }
@@ -66,7 +91,7 @@ class GPUlabSteadyState : public GPUlab
     protected:
         void _apply_bc(const double t = 0)
         {
-            BoundaryConditions<GridMPI> bc(grid.pdata());
+            BoundaryConditions<GridMPI> bc(grid.pdata(), bc_iz, bc_nslices);
             if (myFeature[0] == SKIN) bc.template applyBC_reflecting<0,0,ghostmap::X>(halox.left);
             if (myFeature[1] == SKIN) bc.template applyBC_reflecting<0,1,ghostmap::X>(halox.right);
             if (myFeature[2] == SKIN) bc.template applyBC_reflecting<1,0,ghostmap::Y>(haloy.left);
@@ -21,6 +21,7 @@ typedef double Real;
 #endif
 
 typedef std::vector<Real *> RealPtrVec_t;
+typedef std::vector<TmpReal *> TmpPtrVec_t;
 typedef unsigned int uint_t;
 
 enum Coord {X=0, Y, Z};
@@ -162,7 +163,7 @@ struct StreamerGridPointIterative //dummy
     static const int NY = NodeBlock::sizeY;
     static const int NZ = NodeBlock::sizeZ;
 
-    inline int _id(const int ix, const int iy, const int iz) const { assert(ID3(ix,iy,iz,NX,NY) < NX*NY*NZ); return ID3(ix,iy,iz,NX,NY); }
+    inline int _id(const int ix, const int iy, const int iz) const { assert(NodeBlock::linaccess(ix,iy,iz) < NX*NY*NZ); return NodeBlock::linaccess(ix,iy,iz); }
 
     typedef const Real * const const_ptr;
     const_ptr r, u, v, w, e, G, P;
@@ -199,7 +200,7 @@ struct myTensorialStreamer
 
     void operate(const int ix, const int iy, const int iz, Real out[NCHANNELS]) const
     {
-        const int idx = ID3(ix,iy,iz,NX,NY);
+        const int idx = NodeBlock::linaccess(ix,iy,iz);
         assert(idx < NX * NY * NZ);
         out[0] = r[idx];
         out[1] = u[idx]/r[idx];
@@ -213,6 +214,13 @@ struct myTensorialStreamer
     }
 
     static const char * getAttributeName() { return "Tensor"; }
+
+    // channels 7 and 8 pad the tensor and are zero
+    static const char * getChannelName(const int c)
+    {
+        static const char * const names[NCHANNELS] = {"rho", "u", "v", "w", "p", "G", "P", "zero7", "zero8"};
+        return names[c];
+    }
 };
 
 
@@ -230,12 +238,14 @@ struct myScalarStreamer
 
     void operate(const int ix, const int iy, const int iz, Real out[NCHANNELS]) const
     {
-        const int idx = ID3(ix,iy,iz,NX,NY);
+        const int idx = NodeBlock::linaccess(ix,iy,iz);
         assert(idx < NX * NY * NZ);
         out[0] = r[idx];
     }
 
     static const char * getAttributeName() { return "Scalar"; }
+
+    static const char * getChannelName(const int c) { return "rho"; }
 };
 
 
@@ -253,7 +263,7 @@ struct mySaveStreamer
 
     void operate(const int ix, const int iy, const int iz, Real out[NCHANNELS]) const
     {
-        const int idx = ID3(ix,iy,iz,NX,NY);
+        const int idx = NodeBlock::linaccess(ix,iy,iz);
         assert(idx < NX * NY * NZ);
         out[0] = r[idx];
         out[1] = u[idx];
@@ -266,7 +276,7 @@ struct mySaveStreamer
 
     void operate(const Real input[NCHANNELS], const int ix, const int iy, const int iz) const
     {
-        const int idx = ID3(ix,iy,iz,NX,NY);
+        const int idx = NodeBlock::linaccess(ix,iy,iz);
         assert(idx < NX * NY * NZ);
         r[idx] = input[0];
         u[idx] = input[1];
@@ -278,4 +288,10 @@ struct mySaveStreamer
     }
 
     static const char * getAttributeName() { return "Save Data"; }
+
+    static const char * getChannelName(const int c)
+    {
+        static const char * const names[NCHANNELS] = {"rho", "ru", "rv", "rw", "E", "G", "P"};
+        return names[c];
+    }
 };
@@ -21,10 +21,16 @@ using namespace std;
 
 int main(int argc, const char *argv[])
 {
-    MPI_Init(&argc, const_cast<char***>(&argv));
-
-    /* int provided; */
-    /* MPI_Init_thread(&argc, &argv, MPI_THREAD_MULTIPLE, &provided); */
+    // dumps written by an I/O thread (-asyncdump) and background global
+    // checkpoints (-savelocal) need MPI_THREAD_MULTIPLE
+    ArgumentParser threadparser(argc, argv);
+    if (threadparser("-asyncdump").asBool(false) || !threadparser("-savelocal").asString("").empty())
+    {
+        int provided;
+        MPI_Init_thread(&argc, const_cast<char***>(&argv), MPI_THREAD_MULTIPLE, &provided);
+    }
+    else
+        MPI_Init(&argc, const_cast<char***>(&argv));
 
     int world_size, world_rank;
     MPI_Comm_size(MPI_COMM_WORLD, &world_size);
@@ -0,0 +1,55 @@
+/* *
+ * main.cpp
+ *
+ * Process grids chosen by GridMPI::auto_pesize (-npe auto) for a range of
+ * rank and node counts.  Runs without MPI_Init, returns the number of
+ * failed cases.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#include <stdio.h>
+
+#include "GridMPI.h"
+
+
+struct Case
+{
+    int nranks, nodesize, bs[3], fixed[3];
+    int pesize[3], nodeshape[3]; // expected
+};
+
+int main(int argc, const char *argv[])
+{
+    const Case cases[] = {
+        // one rank per node, single node, many nodes
+        {   8, 1, {16,16,16}, {0,0,0}, { 2, 2, 2}, {1,1,1}},
+        {   8, 8, {16,16,16}, {0,0,0}, { 2, 2, 2}, {2,2,2}},
+        {  64, 8, {16,16,16}, {0,0,0}, { 4, 4, 4}, {2,2,2}},
+        {4096, 8, {16,16,16}, {0,0,0}, {16,16,16}, {2,2,2}},
+        {  64, 4, {16,16,16}, {0,0,0}, { 4, 4, 4}, {1,2,2}},
+        // non-cubic rank count and blocks, fixed dimensions
+        {  16, 4, {16,16,16}, {0,0,0}, { 2, 2, 4}, {2,2,1}},
+        {   8, 1, {32,16,16}, {0,0,0}, { 1, 2, 4}, {1,1,1}},
+        {   8, 4, {32,16,16}, {0,0,0}, { 1, 2, 4}, {1,2,2}},
+        {  16, 2, {16,16,16}, {1,0,0}, { 1, 4, 4}, {1,1,2}},
+        {   7, 1, {16,16,16}, {0,0,0}, { 1, 1, 7}, {1,1,1}},
+    };
+    const int ncases = sizeof(cases) / sizeof(cases[0]);
+
+    int failed = 0;
+    for (int c = 0; c < ncases; ++c)
+    {
+        const Case& t = cases[c];
+        int pesize[3] = {t.fixed[0], t.fixed[1], t.fixed[2]}, nodeshape[3] = {0, 0, 0};
+        const bool found = GridMPI::auto_pesize(t.nranks, t.nodesize, t.bs, pesize, nodeshape);
+        bool ok = found;
+        for (int i = 0; i < 3; ++i)
+            ok = ok && pesize[i] == t.pesize[i] && nodeshape[i] == t.nodeshape[i];
+        printf("%s: %4d ranks, %d per node, block %dx%dx%d -> %dx%dx%d, node %dx%dx%d\n",
+                ok ? "PASS" : "FAIL", t.nranks, t.nodesize, t.bs[0], t.bs[1], t.bs[2],
+                pesize[0], pesize[1], pesize[2], nodeshape[0], nodeshape[1], nodeshape[2]);
+        failed += !ok;
+    }
+
+    return failed;
+}
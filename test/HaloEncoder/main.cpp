@@ -0,0 +1,92 @@
+/* *
+ * main.cpp
+ *
+ * Round trip of halo messages through HaloEncoder: FPC must be bit-exact,
+ * FLOAT within float rounding.  Runs without MPI_Init, returns the number
+ * of failed cases.
+ *
+ * Copyright 2014 ETH Zurich. All rights reserved.
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits>
+#include <vector>
+
+#include "HaloEncoder.h"
+
+
+enum Data {SMOOTH=0, CONSTANT, RANDOM, NONFINITE, ZERO};
+static const char * const names[] = {"smooth", "constant", "random", "nan/inf", "zero"};
+
+static void _fill(std::vector<Real>& v, const Data d)
+{
+    unsigned int seed = 17;
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+        seed = 1103515245u*seed + 12345u;
+        switch (d)
+        {
+            case SMOOTH:   v[i] = 1.0 + 0.5*sin(0.01*i); break;
+            case CONSTANT: v[i] = 101325.0; break;
+            case RANDOM:   v[i] = (Real)((int)seed) * 1.0e-3; break;
+            case NONFINITE:
+                v[i] = (i % 3 == 0) ? std::numeric_limits<Real>::quiet_NaN() :
+                       (i % 3 == 1) ? std::numeric_limits<Real>::infinity() :
+                       -std::numeric_limits<Real>::infinity();
+                break;
+            default:       v[i] = 0.0; break;
+        }
+    }
+}
+
+static bool _check(const std::vector<Real>& in, const std::vector<Real>& out, const HaloEncoder::Encoding enc)
+{
+    if (HaloEncoder::FPC == enc)
+        return 0 == memcmp(&in[0], &out[0], in.size()*sizeof(Real));
+
+    for (size_t i = 0; i < in.size(); ++i)
+    {
+        if (isnan(in[i]))
+        {
+            if (!isnan(out[i])) return false;
+            continue;
+        }
+        if (out[i] != static_cast<Real>(static_cast<float>(in[i])))
+            return false;
+        if (isfinite(in[i]) && fabs(out[i] - in[i]) > fabs(in[i])*std::numeric_limits<float>::epsilon())
+            return false;
+    }
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    const uint_t NVAR = 7;
+    const uint_t sizes[] = {1, 3, 12*10*3, 1001};
+    const HaloEncoder::Encoding encs[] = {HaloEncoder::FLOAT, HaloEncoder::FPC};
+
+    int failed = 0;
+    for (int e = 0; e < 2; ++e)
+        for (int s = 0; s < (int)(sizeof(sizes)/sizeof(sizes[0])); ++s)
+            for (int d = SMOOTH; d <= ZERO; ++d)
+            {
+                const HaloEncoder::Encoding enc = encs[e];
+                const uint_t Nhalo = sizes[s];
+                std::vector<Real> in(NVAR*Nhalo), out(NVAR*Nhalo);
+                _fill(in, (Data)d);
+
+                const size_t bound = HaloEncoder::bound(Nhalo, NVAR, enc);
+                std::vector<unsigned char> buf(bound);
+                const size_t nbytes = HaloEncoder::encode(&in[0], Nhalo, NVAR, &buf[0], enc);
+                HaloEncoder::decode(&buf[0], Nhalo, NVAR, &out[0], enc);
+
+                const bool ok = nbytes <= bound && _check(in, out, enc);
+                printf("%s: %-5s %-8s Nhalo=%4d -> %7d of %7d bytes (raw %7d)\n",
+                        ok ? "PASS" : "FAIL", HaloEncoder::FPC == enc ? "FPC" : "FLOAT",
+                        names[d], (int)Nhalo, (int)nbytes, (int)bound, (int)(NVAR*Nhalo*sizeof(Real)));
+                failed += !ok;
+            }
+
+    return failed;
+}